@@ -2,413 +2,6041 @@
 #include <string>
 #include <limits>
 #include <fstream>
+#include <sstream>
 #include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include <string_view>
+#include <charconv>
+#include <variant>
+#include <type_traits>
+#include <filesystem>
+#include <random>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+// Error codes shared by the exception hierarchy and the non-throwing API
+enum class ErrorCode
+{
+    None,
+    InvalidInput,
+    InvalidId,
+    EmptyCart,
+    NoOrders,
+    InvalidPaymentMethod,
+    InvalidMenuChoice,
+    UnknownCommand,
+    EndOfInput,
+    OutOfStock,
+    Other
+};
+
+// Static message for each error code; never allocates
+const char *errorMessage(ErrorCode code)
+{
+    switch (code)
+    {
+    case ErrorCode::None:
+        return "No error";
+    case ErrorCode::InvalidInput:
+        return "Invalid input. Please enter a valid number.";
+    case ErrorCode::InvalidId:
+        return "Invalid product ID";
+    case ErrorCode::EmptyCart:
+        return "Shopping cart is empty";
+    case ErrorCode::NoOrders:
+        return "No orders found";
+    case ErrorCode::InvalidPaymentMethod:
+        return "Invalid payment method";
+    case ErrorCode::InvalidMenuChoice:
+        return "Invalid menu choice. Please select 1-4.";
+    case ErrorCode::UnknownCommand:
+        return "Unknown command";
+    case ErrorCode::EndOfInput:
+        return "End of input";
+    case ErrorCode::OutOfStock:
+        return "Not enough stock for this product";
+    default:
+        return "Unexpected error";
+    }
+}
+
+// Short identifier for each error code, used in metrics reports
+const char *errorCodeName(ErrorCode code)
+{
+    switch (code)
+    {
+    case ErrorCode::None:
+        return "None";
+    case ErrorCode::InvalidInput:
+        return "InvalidInput";
+    case ErrorCode::InvalidId:
+        return "InvalidId";
+    case ErrorCode::EmptyCart:
+        return "EmptyCart";
+    case ErrorCode::NoOrders:
+        return "NoOrders";
+    case ErrorCode::InvalidPaymentMethod:
+        return "InvalidPaymentMethod";
+    case ErrorCode::InvalidMenuChoice:
+        return "InvalidMenuChoice";
+    case ErrorCode::UnknownCommand:
+        return "UnknownCommand";
+    case ErrorCode::EndOfInput:
+        return "EndOfInput";
+    case ErrorCode::OutOfStock:
+        return "OutOfStock";
+    default:
+        return "Other";
+    }
+}
+
+// Instrumented hot paths
+enum class Metric
+{
+    CartAdd,
+    CartTotal,
+    Payment,
+    OrderCreate,
+    OrderLogWrite,
+    JournalWrite,
+    Checkout,
+    Count
+};
+
+const char *metricName(Metric metric)
+{
+    switch (metric)
+    {
+    case Metric::CartAdd:
+        return "cart.add";
+    case Metric::CartTotal:
+        return "cart.total";
+    case Metric::Payment:
+        return "payment.pay";
+    case Metric::OrderCreate:
+        return "order.create";
+    case Metric::OrderLogWrite:
+        return "order.log";
+    case Metric::JournalWrite:
+        return "order.journal";
+    case Metric::Checkout:
+        return "checkout";
+    default:
+        return "unknown";
+    }
+}
+
+// Always-on instrumentation. Each thread owns a block of counters and
+// log-linear latency histograms (16 sub-buckets per power of two, about 6%
+// resolution) that only it writes, so recording is a plain relaxed
+// load/store with no shared cache lines. Reports add the blocks up.
+// Checkout-thread paths are timed on a 1-in-16 sample to keep clock reads
+// off most calls; log writes are always timed. Event counts are exact.
+class Metrics
+{
+public:
+    static const int METRICS = (int)Metric::Count;
+    static const int ERROR_CODES = (int)ErrorCode::Other + 1;
+    static const int SUB_BUCKETS = 16;
+    static const int BUCKETS = (64 - 4 + 1) * SUB_BUCKETS;
+
+    struct Summary
+    {
+        unsigned long long events;
+        unsigned long long samples;
+        double meanNs;
+        unsigned long long p50Ns, p99Ns, p999Ns, maxNs;
+    };
+
+private:
+    struct ThreadBlock
+    {
+        atomic<unsigned long long> events[METRICS];
+        atomic<unsigned long long> histogram[METRICS][BUCKETS];
+        atomic<unsigned long long> sampleSum[METRICS];
+        atomic<unsigned long long> sampleMax[METRICS];
+        atomic<unsigned long long> errors[ERROR_CODES];
+        unsigned int ticks[METRICS]; // owner-only sampling counters
+    };
+
+    static mutex &registryLock()
+    {
+        static mutex lock;
+        return lock;
+    }
+
+    // Blocks outlive their threads so counts survive until the report
+    static vector<unique_ptr<ThreadBlock>> &registry()
+    {
+        static vector<unique_ptr<ThreadBlock>> blocks;
+        return blocks;
+    }
+
+    static ThreadBlock &local()
+    {
+        thread_local ThreadBlock *block = nullptr;
+        if (!block)
+        {
+            unique_ptr<ThreadBlock> fresh(new ThreadBlock());
+            block = fresh.get();
+            lock_guard<mutex> guard(registryLock());
+            registry().push_back(std::move(fresh));
+        }
+        return *block;
+    }
+
+    // Single-writer increment: no locked read-modify-write needed
+    static void bump(atomic<unsigned long long> &counter, unsigned long long by = 1)
+    {
+        counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+    }
+
+    static int bucketFor(unsigned long long ns)
+    {
+        if (ns < SUB_BUCKETS)
+            return (int)ns;
+        int exponent = 63;
+        while (!(ns >> exponent))
+        {
+            exponent--;
+        }
+        return (exponent - 3) * SUB_BUCKETS + (int)((ns >> (exponent - 4)) & (SUB_BUCKETS - 1));
+    }
+
+    // Largest value that falls into the bucket
+    static unsigned long long bucketCeiling(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return (unsigned long long)bucket;
+        int exponent = bucket / SUB_BUCKETS + 3;
+        unsigned long long sub = (unsigned long long)(bucket % SUB_BUCKETS);
+        return ((SUB_BUCKETS + sub + 1) << (exponent - 4)) - 1;
+    }
+
+    static bool isSampled(Metric metric)
+    {
+        return metric != Metric::OrderLogWrite && metric != Metric::JournalWrite && metric != Metric::Checkout;
+    }
+
+public:
+    // Counts one event and says whether this one should also be timed
+    static bool begin(Metric metric)
+    {
+        ThreadBlock &block = local();
+        int m = (int)metric;
+        bump(block.events[m]);
+        return !isSampled(metric) || (block.ticks[m]++ & 15) == 0;
+    }
+
+    static void record(Metric metric, unsigned long long ns)
+    {
+        ThreadBlock &block = local();
+        int m = (int)metric;
+        bump(block.histogram[m][bucketFor(ns)]);
+        bump(block.sampleSum[m], ns);
+        if (ns > block.sampleMax[m].load(memory_order_relaxed))
+            block.sampleMax[m].store(ns, memory_order_relaxed);
+    }
+
+    // Counts and records an event timed by the caller
+    static void recordEvent(Metric metric, unsigned long long ns)
+    {
+        bump(local().events[(int)metric]);
+        record(metric, ns);
+    }
+
+    // Called by every ECommerceException, so thrown errors are counted by type
+    static void countError(ErrorCode code) { bump(local().errors[(int)code]); }
+
+    static Summary summarize(Metric metric)
+    {
+        int m = (int)metric;
+        vector<unsigned long long> counts(BUCKETS, 0);
+        Summary summary = {0, 0, 0.0, 0, 0, 0, 0};
+        unsigned long long sum = 0;
+        {
+            lock_guard<mutex> guard(registryLock());
+            vector<unique_ptr<ThreadBlock>> &blocks = registry();
+            for (size_t t = 0; t < blocks.size(); t++)
+            {
+                summary.events += blocks[t]->events[m].load(memory_order_relaxed);
+                sum += blocks[t]->sampleSum[m].load(memory_order_relaxed);
+                summary.maxNs = max(summary.maxNs, blocks[t]->sampleMax[m].load(memory_order_relaxed));
+                for (int b = 0; b < BUCKETS; b++)
+                {
+                    counts[b] += blocks[t]->histogram[m][b].load(memory_order_relaxed);
+                }
+            }
+        }
+        for (int b = 0; b < BUCKETS; b++)
+        {
+            summary.samples += counts[b];
+        }
+        if (summary.samples == 0)
+            return summary;
+        summary.meanNs = (double)sum / (double)summary.samples;
+
+        // Percentiles report the top of the bucket holding the rank
+        unsigned long long *targets[3] = {&summary.p50Ns, &summary.p99Ns, &summary.p999Ns};
+        const double quantiles[3] = {0.50, 0.99, 0.999};
+        for (int q = 0; q < 3; q++)
+        {
+            unsigned long long rank = (unsigned long long)(quantiles[q] * (double)summary.samples);
+            if (rank == 0)
+                rank = 1;
+            unsigned long long seen = 0;
+            for (int b = 0; b < BUCKETS; b++)
+            {
+                seen += counts[b];
+                if (seen >= rank)
+                {
+                    *targets[q] = min(bucketCeiling(b), summary.maxNs);
+                    break;
+                }
+            }
+        }
+        return summary;
+    }
+
+    static unsigned long long errorCount(ErrorCode code)
+    {
+        unsigned long long total = 0;
+        lock_guard<mutex> guard(registryLock());
+        vector<unique_ptr<ThreadBlock>> &blocks = registry();
+        for (size_t t = 0; t < blocks.size(); t++)
+        {
+            total += blocks[t]->errors[(int)code].load(memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+// Counts and (when sampled) times the enclosing scope
+class ScopedTimer
+{
+private:
+    Metric metric;
+    bool timed;
+    chrono::steady_clock::time_point start;
+
+public:
+    explicit ScopedTimer(Metric m) : metric(m), timed(Metrics::begin(m))
+    {
+        if (timed)
+            start = chrono::steady_clock::now();
+    }
+
+    ~ScopedTimer()
+    {
+        if (timed)
+        {
+            chrono::steady_clock::duration elapsed = chrono::steady_clock::now() - start;
+            Metrics::record(metric, (unsigned long long)chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+        }
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+};
+
 // Exception classes
 class ECommerceException : public exception
 {
 private:
-    string message;
+    string message;            // only used for custom messages
+    const char *staticMessage; // set for error-code exceptions, no allocation
+    ErrorCode code;
 
 public:
-    ECommerceException(const string &msg) : message(msg) {}
-    const char *what() const noexcept override { return message.c_str(); }
+    ECommerceException(const string &msg) : message(msg), staticMessage(nullptr), code(ErrorCode::Other)
+    {
+        Metrics::countError(code);
+    }
+    explicit ECommerceException(ErrorCode c) : staticMessage(errorMessage(c)), code(c) { Metrics::countError(c); }
+    const char *what() const noexcept override { return staticMessage ? staticMessage : message.c_str(); }
+    ErrorCode getCode() const { return code; }
 };
 
 class InvalidIDException : public ECommerceException
 {
 public:
-    InvalidIDException() : ECommerceException("Invalid product ID") {}
+    InvalidIDException() : ECommerceException(ErrorCode::InvalidId) {}
 };
 
 class EmptyCartException : public ECommerceException
 {
 public:
-    EmptyCartException() : ECommerceException("Shopping cart is empty") {}
+    EmptyCartException() : ECommerceException(ErrorCode::EmptyCart) {}
 };
 
 class NoOrdersException : public ECommerceException
 {
 public:
-    NoOrdersException() : ECommerceException("No orders found") {}
+    NoOrdersException() : ECommerceException(ErrorCode::NoOrders) {}
 };
 
 class InvalidInputException : public ECommerceException
 {
 public:
-    InvalidInputException() : ECommerceException("Invalid input. Please enter a valid number.") {}
+    InvalidInputException() : ECommerceException(ErrorCode::InvalidInput) {}
+};
+
+class InvalidPaymentMethodException : public ECommerceException
+{
+public:
+    InvalidPaymentMethodException() : ECommerceException(ErrorCode::InvalidPaymentMethod) {}
 };
 
+class OutOfStockException : public ECommerceException
+{
+public:
+    OutOfStockException() : ECommerceException(ErrorCode::OutOfStock) {}
+};
+
+// Value-or-error result for paths where bad input is common and unwinding is too costly
+template <typename T>
+class Expected
+{
+private:
+    T value;
+    ErrorCode error;
+
+public:
+    Expected(const T &v) : value(v), error(ErrorCode::None) {}
+    Expected(ErrorCode e) : value(), error(e) {}
+
+    bool hasValue() const { return error == ErrorCode::None; }
+    explicit operator bool() const { return hasValue(); }
+    const T &operator*() const { return value; }
+    const T *operator->() const { return &value; }
+    ErrorCode getError() const { return error; }
+    const char *message() const { return errorMessage(error); }
+};
+
+// Non-throwing validated input: reads one value terminated by end of line
+template <typename T>
+Expected<T> tryGetValidatedInput(const char *prompt)
+{
+    T value;
+    cout << prompt;
+    cin >> value;
+
+    if (cin.fail())
+    {
+        if (cin.eof())
+            return ErrorCode::EndOfInput;
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        return ErrorCode::InvalidInput;
+    }
+
+    if (cin.peek() != '\n')
+    {
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        return ErrorCode::InvalidInput;
+    }
+
+    cin.ignore();
+    return value;
+}
+
 // Template function for validated input
 template <typename T>
 T getValidatedInput(const string &prompt)
 {
-    T value;
-    while (true)
+    Expected<T> result = tryGetValidatedInput<T>(prompt.c_str());
+    if (!result)
+    {
+        throw InvalidInputException();
+    }
+    return *result;
+}
+
+// Money class: exact amounts in integer cents
+class Money
+{
+private:
+    long long cents;
+
+    explicit constexpr Money(long long c) : cents(c) {}
+
+public:
+    constexpr Money() : cents(0) {}
+
+    static constexpr Money fromCents(long long c) { return Money(c); }
+
+    constexpr long long getCents() const { return cents; }
+
+    constexpr Money operator+(Money other) const { return Money(cents + other.cents); }
+    constexpr Money operator-(Money other) const { return Money(cents - other.cents); }
+    constexpr Money operator*(long long quantity) const { return Money(cents * quantity); }
+    Money &operator+=(Money other)
+    {
+        cents += other.cents;
+        return *this;
+    }
+    Money &operator-=(Money other)
+    {
+        cents -= other.cents;
+        return *this;
+    }
+    constexpr bool operator==(Money other) const { return cents == other.cents; }
+    constexpr bool operator!=(Money other) const { return cents != other.cents; }
+    constexpr bool operator<(Money other) const { return cents < other.cents; }
+
+    // Writes "1234.56" into text (at least 24 bytes) and returns its length
+    size_t format(char *text) const
+    {
+        unsigned long long magnitude = cents < 0 ? 0ull - (unsigned long long)cents : (unsigned long long)cents;
+        char *p = text;
+        if (cents < 0)
+            *p++ = '-';
+        p = to_chars(p, text + 21, magnitude / 100).ptr;
+        *p++ = '.';
+        *p++ = (char)('0' + magnitude % 100 / 10);
+        *p++ = (char)('0' + magnitude % 10);
+        return p - text;
+    }
+
+    // Honours the stream width like a single field
+    friend ostream &operator<<(ostream &os, Money amount)
+    {
+        char text[24];
+        size_t length = amount.format(text);
+        text[length] = '\0';
+        return os << text;
+    }
+};
+
+// Table renderer: formats rows into a reusable buffer that is written out in
+// one call, instead of many width()/<< calls per cell
+class TableRenderer
+{
+private:
+    string buffer;
+
+    void pad(size_t length, int width)
+    {
+        if ((int)length < width)
+            buffer.append(width - length, ' ');
+    }
+
+public:
+    TableRenderer &text(string_view s)
+    {
+        buffer.append(s.data(), s.size());
+        return *this;
+    }
+
+    TableRenderer &number(long long value)
+    {
+        char digits[24];
+        return text(string_view(digits, to_chars(digits, digits + sizeof(digits), value).ptr - digits));
+    }
+
+    TableRenderer &money(Money amount)
+    {
+        char digits[24];
+        return text(string_view(digits, amount.format(digits)));
+    }
+
+    TableRenderer &left(string_view s, int width)
+    {
+        text(s);
+        pad(s.size(), width);
+        return *this;
+    }
+
+    TableRenderer &right(string_view s, int width)
+    {
+        pad(s.size(), width);
+        return text(s);
+    }
+
+    TableRenderer &right(long long value, int width)
+    {
+        char digits[24];
+        return right(string_view(digits, to_chars(digits, digits + sizeof(digits), value).ptr - digits), width);
+    }
+
+    TableRenderer &right(Money amount, int width)
+    {
+        char digits[24];
+        return right(string_view(digits, amount.format(digits)), width);
+    }
+
+    // Table cell after another cell: one separating space, then right-aligned,
+    // so a value wider than its column never runs into the previous one
+    TableRenderer &column(string_view s, int width) { return text(" ").right(s, width); }
+    TableRenderer &column(long long value, int width) { return text(" ").right(value, width); }
+    TableRenderer &column(Money amount, int width) { return text(" ").right(amount, width); }
+
+    size_t size() const { return buffer.size(); }
+
+    // Writes everything rendered so far in one call and keeps the capacity
+    void flushTo(ostream &out)
+    {
+        out.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    // Per-thread renderer whose buffer is reused across tables
+    static TableRenderer &shared()
+    {
+        static thread_local TableRenderer renderer;
+        return renderer;
+    }
+};
+
+// Column widths of the product, cart and order tables; prices and line
+// totals stay aligned up to 9999999.99 and 99999999.99
+const int ID_WIDTH = 4;
+const int NAME_WIDTH = 14;
+const int PRICE_WIDTH = 10;
+const int QTY_WIDTH = 4;
+const int LINE_TOTAL_WIDTH = 11;
+
+// Product class
+class Product
+{
+private:
+    int id;
+    string name;
+    Money price;
+
+public:
+    Product(int id, const string &name, Money price) : id(id), name(name), price(price) {}
+
+    int getId() const { return id; }
+    const string &getName() const { return name; }
+    Money getPrice() const { return price; }
+    void setPrice(Money newPrice) { price = newPrice; }
+};
+
+// Batch pricing kernels over structure-of-arrays columns of cents and
+// quantities. The SIMD path is chosen at compile time (-mavx2, or NEON on
+// ARM); quantities must be non-negative.
+class PricingEngine
+{
+public:
+    static const char *kernelName()
+    {
+#if defined(__AVX2__)
+        return "avx2";
+#elif defined(__ARM_NEON)
+        return "neon";
+#else
+        return "scalar";
+#endif
+    }
+
+    static long long cartTotalScalar(const long long *priceCents, const int *quantities, size_t n)
+    {
+        long long total = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            total += priceCents[i] * quantities[i];
+        }
+        return total;
+    }
+
+    // Sum of price * quantity. Each 64-bit price is multiplied as two 32-bit
+    // halves, since neither AVX2 nor NEON has a 64-bit vector multiply.
+    static long long cartTotal(const long long *priceCents, const int *quantities, size_t n)
     {
-        cout << prompt;
-        cin >> value;
+        size_t i = 0;
+        long long total = 0;
+#if defined(__AVX2__)
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(priceCents + i));
+            __m256i q = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i *>(quantities + i)));
+            __m256i lo = _mm256_mul_epu32(p, q);
+            __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(p, 32), q);
+            acc = _mm256_add_epi64(acc, _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32)));
+        }
+        long long lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), acc);
+        total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__ARM_NEON)
+        uint64x2_t acc = vdupq_n_u64(0);
+        for (; i + 2 <= n; i += 2)
+        {
+            uint64x2_t p = vld1q_u64(reinterpret_cast<const uint64_t *>(priceCents + i));
+            uint32x2_t q = vld1_u32(reinterpret_cast<const uint32_t *>(quantities + i));
+            uint64x2_t lo = vmull_u32(vmovn_u64(p), q);
+            uint64x2_t hi = vmull_u32(vshrn_n_u64(p, 32), q);
+            acc = vaddq_u64(acc, vaddq_u64(lo, vshlq_n_u64(hi, 32)));
+        }
+        total = (long long)(vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1));
+#endif
+        return total + cartTotalScalar(priceCents + i, quantities + i, n - i);
+    }
+
+    // Scales cents by (10000 + basisPoints) / 10000, rounding half away from zero
+    static long long applyBasisPoints(long long cents, int basisPoints)
+    {
+        long long scaled = cents * (10000 + basisPoints);
+        return (scaled + (scaled < 0 ? -5000 : 5000)) / 10000;
+    }
+
+    // Cart total after a percentage discount (e.g. 1500 = 15% off)
+    static long long discountedTotal(const long long *priceCents, const int *quantities, size_t n,
+                                     int discountBasisPoints)
+    {
+        return applyBasisPoints(cartTotal(priceCents, quantities, n), -discountBasisPoints);
+    }
+
+    // Catalog-wide price change in basis points. This stays an exact integer
+    // loop: AVX2 and NEON have no 64-bit divide or multiply-high, and a
+    // floating-point shortcut would not round to the cent reliably.
+    static void reprice(long long *priceCents, size_t n, int changeBasisPoints)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            priceCents[i] = applyBasisPoints(priceCents[i], changeBasisPoints);
+        }
+    }
+};
+
+// Open-addressing hash index mapping an integer key (e.g. product ID) to a slot.
+// Every int is a valid key; an empty entry is marked by its value, so stored
+// values (slots) must not be negative.
+class IdIndex
+{
+private:
+    struct Entry
+    {
+        int key;
+        int value;
+    };
+
+    static const int EMPTY_VALUE = -1;
+
+    vector<Entry> entries;
+    size_t used;
+
+    void rehash(size_t newSize)
+    {
+        vector<Entry> old;
+        old.swap(entries);
+        entries.assign(newSize, Entry{0, EMPTY_VALUE});
+        used = 0;
+        for (size_t i = 0; i < old.size(); i++)
+        {
+            if (old[i].value != EMPTY_VALUE)
+            {
+                insert(old[i].key, old[i].value);
+            }
+        }
+    }
+
+public:
+    IdIndex() : used(0) {}
 
-        if (cin.fail())
+    // Also used by the on-disk catalog index (see MappedCatalog)
+    static size_t hashKey(int key)
+    {
+        // Fibonacci hashing spreads sequential IDs across the table
+        return (size_t)((unsigned long long)(unsigned int)key * 11400714819323198485ull >> 17);
+    }
+
+    // Size the table so that n keys can be inserted without rehashing
+    void reserve(size_t n)
+    {
+        size_t needed = 16;
+        while (needed < n * 2)
+        {
+            needed *= 2;
+        }
+        if (needed > entries.size())
+        {
+            rehash(needed);
+        }
+    }
+
+    // Returns the slot stored for key, or -1 if the key is not present
+    int find(int key) const
+    {
+        if (entries.empty())
+            return -1;
+        size_t mask = entries.size() - 1;
+        for (size_t i = hashKey(key) & mask;; i = (i + 1) & mask)
+        {
+            if (entries[i].value == EMPTY_VALUE)
+                return -1;
+            if (entries[i].key == key)
+                return entries[i].value;
+        }
+    }
+
+    // Inserts key, or overwrites its slot if it is already present; value >= 0
+    void insert(int key, int value)
+    {
+        if ((used + 1) * 2 > entries.size())
+        {
+            rehash(entries.empty() ? 16 : entries.size() * 2);
+        }
+        size_t mask = entries.size() - 1;
+        for (size_t i = hashKey(key) & mask;; i = (i + 1) & mask)
+        {
+            if (entries[i].value == EMPTY_VALUE)
+            {
+                entries[i].key = key;
+                entries[i].value = value;
+                used++;
+                return;
+            }
+            if (entries[i].key == key)
+            {
+                entries[i].value = value;
+                return;
+            }
+        }
+    }
+
+    // Removes key using backward-shift deletion, so no tombstones accumulate
+    bool erase(int key)
+    {
+        if (entries.empty())
+            return false;
+        size_t mask = entries.size() - 1;
+        size_t hole = hashKey(key) & mask;
+        for (;; hole = (hole + 1) & mask)
+        {
+            if (entries[hole].value == EMPTY_VALUE)
+                return false;
+            if (entries[hole].key == key)
+                break;
+        }
+        for (size_t next = (hole + 1) & mask; entries[next].value != EMPTY_VALUE; next = (next + 1) & mask)
+        {
+            // An entry may fill the hole only if its home slot is not within (hole, next]
+            size_t home = hashKey(entries[next].key) & mask;
+            bool homeBetween = hole <= next ? (home > hole && home <= next) : (home > hole || home <= next);
+            if (!homeBetween)
+            {
+                entries[hole] = entries[next];
+                hole = next;
+            }
+        }
+        entries[hole].value = EMPTY_VALUE;
+        used--;
+        return true;
+    }
+
+    // Removes every key but keeps the table allocated for reuse
+    void clear()
+    {
+        if (used == 0)
+            return;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            entries[i].value = EMPTY_VALUE;
+        }
+        used = 0;
+    }
+
+    size_t size() const { return used; }
+};
+
+// Read-only memory mapping of a whole file; pages are loaded on first touch
+class MappedFile
+{
+private:
+    const char *base;
+    size_t length;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+
+public:
+#ifdef _WIN32
+    MappedFile() : base(nullptr), length(0), file(INVALID_HANDLE_VALUE), mapping(nullptr) {}
+#else
+    MappedFile() : base(nullptr), length(0), fd(-1) {}
+#endif
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const string &path)
+    {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        GetFileSizeEx(file, &size);
+        length = (size_t)size.QuadPart;
+        if (length == 0)
+            return true;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+        {
+            base = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            close();
+            return false;
+        }
+        length = (size_t)info.st_size;
+        if (length == 0)
+            return true;
+        void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        base = p == MAP_FAILED ? nullptr : static_cast<const char *>(p);
+#endif
+        if (!base)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (base)
+            UnmapViewOfFile(base);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (base)
+            munmap(const_cast<char *>(base), length);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        base = nullptr;
+        length = 0;
+    }
+
+    // Hint that the mapping will be read front to back
+    void adviseSequential() const
+    {
+#ifndef _WIN32
+        if (base)
+            madvise(const_cast<char *>(base), length, MADV_SEQUENTIAL);
+#endif
+    }
+
+    // Hint that access is scattered, so the kernel should not read ahead
+    void adviseRandom() const
+    {
+#ifndef _WIN32
+        if (base)
+            madvise(const_cast<char *>(base), length, MADV_RANDOM);
+#endif
+    }
+
+    const char *data() const { return base; }
+    size_t size() const { return length; }
+};
+
+// On-disk catalog image, used in place through a read-only mapping:
+//   header | fixed-width records | ID hash index | string pool of names
+// The index is an open-addressing table of record numbers + 1 (0 = empty),
+// probed with IdIndex::hashKey. Nothing is parsed at open time; pages are
+// faulted in only as lookups touch them.
+const char CATALOG_IMAGE_MAGIC[8] = {'P', 'R', 'D', 'C', 'A', 'T', '0', '1'};
+
+struct CatalogImageHeader
+{
+    char magic[8];
+    unsigned int recordCount;
+    unsigned int indexSlots; // power of two, more than recordCount
+    unsigned long long recordsOffset;
+    unsigned long long indexOffset;
+    unsigned long long stringsOffset;
+    unsigned long long stringsLength;
+};
+
+struct CatalogRecord
+{
+    int id;
+    unsigned int nameLength;
+    unsigned long long nameOffset; // into the string pool
+    long long priceCents;
+};
+static_assert(sizeof(CatalogRecord) == 24, "catalog records are fixed-width on disk");
+
+// Read-only catalog image. Product objects are built on first lookup and
+// cached in lock-free slots, so concurrent readers share one copy of each.
+class MappedCatalog
+{
+private:
+    static const size_t SLOT_CHUNK = 4096;
+    typedef atomic<const Product *> Slot;
+
+    MappedFile file;
+    const CatalogImageHeader *header;
+    const CatalogRecord *records;
+    const unsigned int *index;
+    const char *strings;
+
+    // Chunks of cached products, allocated as lookups reach them
+    unique_ptr<atomic<Slot *>[]> slotChunks;
+    size_t chunkCount;
+
+    Product build(size_t record) const
+    {
+        const CatalogRecord &r = records[record];
+        return Product(r.id, string(nameAt(record)), Money::fromCents(r.priceCents));
+    }
+
+public:
+    MappedCatalog() : header(nullptr), records(nullptr), index(nullptr), strings(nullptr), chunkCount(0) {}
+    MappedCatalog(const MappedCatalog &) = delete;
+    MappedCatalog &operator=(const MappedCatalog &) = delete;
+
+    ~MappedCatalog()
+    {
+        for (size_t c = 0; c < chunkCount; c++)
+        {
+            Slot *chunk = slotChunks[c].load();
+            if (!chunk)
+                continue;
+            for (size_t i = 0; i < SLOT_CHUNK; i++)
+            {
+                delete chunk[i].load();
+            }
+            delete[] chunk;
+        }
+    }
+
+    // Maps the image and checks its layout; returns false if it is not usable
+    bool open(const string &path)
+    {
+        if (!file.open(path) || file.size() < sizeof(CatalogImageHeader))
+            return false;
+        const char *base = file.data();
+        header = reinterpret_cast<const CatalogImageHeader *>(base);
+        unsigned long long size = file.size();
+        unsigned long long slots = header->indexSlots;
+        unsigned long long recordBytes = sizeof(CatalogRecord) * (unsigned long long)header->recordCount;
+        unsigned long long indexBytes = sizeof(unsigned int) * slots;
+        // Written as offset <= size && length <= size - offset so that offsets
+        // from a damaged header cannot wrap around; once a section is known to
+        // fit, its end offset is safe to compute
+        auto fits = [size](unsigned long long offset, unsigned long long length)
+        { return offset <= size && length <= size - offset; };
+        if (memcmp(header->magic, CATALOG_IMAGE_MAGIC, sizeof(header->magic)) != 0 || slots == 0 ||
+            (slots & (slots - 1)) != 0 || slots <= header->recordCount ||
+            header->recordsOffset % 8 != 0 || header->indexOffset % 4 != 0 ||
+            header->recordsOffset < sizeof(CatalogImageHeader) ||
+            !fits(header->recordsOffset, recordBytes) || !fits(header->indexOffset, indexBytes) ||
+            !fits(header->stringsOffset, header->stringsLength) ||
+            header->recordsOffset + recordBytes > header->indexOffset ||
+            header->indexOffset + indexBytes > header->stringsOffset)
+        {
+            file.close();
+            header = nullptr;
+            return false;
+        }
+        records = reinterpret_cast<const CatalogRecord *>(base + header->recordsOffset);
+        index = reinterpret_cast<const unsigned int *>(base + header->indexOffset);
+        strings = base + header->stringsOffset;
+        file.adviseRandom();
+
+        chunkCount = (header->recordCount + SLOT_CHUNK - 1) / SLOT_CHUNK;
+        slotChunks.reset(new atomic<Slot *>[chunkCount]);
+        for (size_t c = 0; c < chunkCount; c++)
+        {
+            slotChunks[c].store(nullptr, memory_order_relaxed);
+        }
+        return true;
+    }
+
+    size_t size() const { return header ? header->recordCount : 0; }
+    int idAt(size_t record) const { return records[record].id; }
+
+    // The record's name, read in place from the string pool
+    string_view nameAt(size_t record) const
+    {
+        const CatalogRecord &r = records[record];
+        if (r.nameOffset <= header->stringsLength && r.nameLength <= header->stringsLength - r.nameOffset)
+            return string_view(strings + r.nameOffset, r.nameLength);
+        return string_view();
+    }
+
+    // Record number for the ID, or -1 if the image has no such product
+    int findRecord(int id) const
+    {
+        if (!header)
+            return -1;
+        size_t mask = header->indexSlots - 1;
+        size_t probe = IdIndex::hashKey(id) & mask;
+        for (size_t tries = 0; tries <= mask; tries++, probe = (probe + 1) & mask)
+        {
+            unsigned int entry = index[probe];
+            if (entry == 0 || entry > header->recordCount)
+                return -1;
+            if (records[entry - 1].id == id)
+                return (int)entry - 1;
+        }
+        return -1;
+    }
+
+    // The record as a Product; built once, then shared by every caller
+    const Product &product(size_t record) const
+    {
+        atomic<Slot *> &chunkSlot = slotChunks[record / SLOT_CHUNK];
+        Slot *chunk = chunkSlot.load(memory_order_acquire);
+        if (!chunk)
+        {
+            Slot *fresh = new Slot[SLOT_CHUNK];
+            for (size_t i = 0; i < SLOT_CHUNK; i++)
+            {
+                fresh[i].store(nullptr, memory_order_relaxed);
+            }
+            if (chunkSlot.compare_exchange_strong(chunk, fresh, memory_order_acq_rel, memory_order_acquire))
+                chunk = fresh;
+            else
+                delete[] fresh;
+        }
+
+        Slot &slot = chunk[record % SLOT_CHUNK];
+        const Product *cached = slot.load(memory_order_acquire);
+        if (!cached)
+        {
+            const Product *built = new Product(build(record));
+            if (slot.compare_exchange_strong(cached, built, memory_order_acq_rel, memory_order_acquire))
+                cached = built;
+            else
+                delete built;
+        }
+        return *cached;
+    }
+};
+
+// Product catalog: products in contiguous storage, indexed by ID. It may sit
+// on top of a mapped catalog image, in which case products added or
+// re-priced in memory shadow the image's records with the same ID.
+class ProductCatalog
+{
+private:
+    vector<Product> products;
+    IdIndex index;
+    shared_ptr<const MappedCatalog> image; // shared by every copy of the catalog
+    vector<int> ownOnly;                   // positions in products not shadowing an image record
+    unsigned long long names;              // see namesVersion()
+
+    size_t imageSize() const { return image ? image->size() : 0; }
+
+    static unsigned long long freshNamesVersion()
+    {
+        static atomic<unsigned long long> next(1);
+        return next.fetch_add(1, memory_order_relaxed);
+    }
+
+public:
+    ProductCatalog() : names(freshNamesVersion()) {}
+
+    // Changes whenever a product or name is added, replaced or dropped, but not
+    // on price changes. Copies keep it, so equal values mean the same names.
+    unsigned long long namesVersion() const { return names; }
+
+    // Replaces the catalog contents; later duplicates of an ID win
+    void load(const vector<Product> &items)
+    {
+        names = freshNamesVersion();
+        products.clear();
+        index.clear();
+        ownOnly.clear();
+        image.reset();
+        products.reserve(items.size());
+        index.reserve(items.size());
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            add(items[i]);
+        }
+    }
+
+    // Replaces the catalog contents with a mapped image; nothing is read yet
+    void loadImage(shared_ptr<const MappedCatalog> mapped)
+    {
+        names = freshNamesVersion();
+        products.clear();
+        index.clear();
+        ownOnly.clear();
+        image = std::move(mapped);
+    }
+
+    void add(const Product &product)
+    {
+        string_view previous;
+        if (!findName(product.getId(), previous) || previous != product.getName())
+            names = freshNamesVersion();
+        int slot = index.find(product.getId());
+        if (slot >= 0)
+        {
+            products[slot] = product;
+            return;
+        }
+        index.insert(product.getId(), (int)products.size());
+        if (!image || image->findRecord(product.getId()) < 0)
+            ownOnly.push_back((int)products.size());
+        products.push_back(product);
+    }
+
+    // Returns false if no product has this ID
+    bool setPrice(int id, Money price)
+    {
+        int slot = index.find(id);
+        if (slot >= 0)
+        {
+            products[slot].setPrice(price);
+            return true;
+        }
+        const Product *mapped = find(id);
+        if (!mapped)
+            return false;
+        Product changed = *mapped;
+        changed.setPrice(price);
+        add(changed);
+        return true;
+    }
+
+    // Changes every price by the given basis points (e.g. -1000 = 10% off).
+    // Image-backed products are copied into memory to hold their new price.
+    void reprice(int changeBasisPoints)
+    {
+        size_t count = size();
+        vector<long long> column(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            column[i] = (*this)[i].getPrice().getCents();
+        }
+        PricingEngine::reprice(column.data(), column.size(), changeBasisPoints);
+        for (size_t i = 0; i < count; i++)
+        {
+            setPrice((*this)[i].getId(), Money::fromCents(column[i]));
+        }
+    }
+
+    // Returns the product with the given ID, or nullptr if none exists
+    const Product *find(int id) const
+    {
+        int slot = index.find(id);
+        if (slot >= 0)
+            return &products[slot];
+        int record = image ? image->findRecord(id) : -1;
+        return record >= 0 ? &image->product(record) : nullptr;
+    }
+
+    Expected<const Product *> tryFind(int id) const
+    {
+        const Product *product = find(id);
+        if (!product)
+            return ErrorCode::InvalidId;
+        return product;
+    }
+
+    // Image records come first (in file order), then products only held in memory
+    size_t size() const { return imageSize() + ownOnly.size(); }
+
+    const Product &operator[](size_t i) const
+    {
+        size_t mapped = imageSize();
+        if (i >= mapped)
+            return products[ownOnly[i - mapped]];
+        int slot = index.find(image->idAt(i));
+        return slot >= 0 ? products[slot] : image->product(i);
+    }
+
+    // ID and name of the i-th product; unlike operator[] these never build
+    // a Product from the image, so whole-catalog scans stay in place
+    int idAt(size_t i) const
+    {
+        size_t mapped = imageSize();
+        return i >= mapped ? products[ownOnly[i - mapped]].getId() : image->idAt(i);
+    }
+
+    string_view nameAt(size_t i) const
+    {
+        size_t mapped = imageSize();
+        if (i >= mapped)
+            return products[ownOnly[i - mapped]].getName();
+        int slot = index.find(image->idAt(i));
+        return slot >= 0 ? string_view(products[slot].getName()) : image->nameAt(i);
+    }
+
+    // Name of the product with the given ID, read in place; false if none exists
+    bool findName(int id, string_view &name) const
+    {
+        int slot = index.find(id);
+        if (slot >= 0)
+        {
+            name = products[slot].getName();
+            return true;
+        }
+        int record = image ? image->findRecord(id) : -1;
+        if (record < 0)
+            return false;
+        name = image->nameAt(record);
+        return true;
+    }
+};
+
+// Writes the catalog as an image, replacing path only once it is complete
+bool writeCatalogImage(const string &path, const ProductCatalog &catalog)
+{
+    size_t slots = 16;
+    while (slots <= catalog.size() * 2)
+    {
+        slots *= 2;
+    }
+
+    CatalogImageHeader header;
+    memcpy(header.magic, CATALOG_IMAGE_MAGIC, sizeof(header.magic));
+    header.recordCount = (unsigned int)catalog.size();
+    header.indexSlots = (unsigned int)slots;
+    header.recordsOffset = sizeof(CatalogImageHeader);
+    header.indexOffset = header.recordsOffset + sizeof(CatalogRecord) * catalog.size();
+    header.stringsOffset = header.indexOffset + sizeof(unsigned int) * slots;
+    header.stringsLength = 0;
+
+    vector<CatalogRecord> records(catalog.size());
+    vector<unsigned int> index(slots, 0);
+    string pool;
+    for (size_t i = 0; i < catalog.size(); i++)
+    {
+        const string &name = catalog[i].getName();
+        records[i] = CatalogRecord{catalog[i].getId(), (unsigned int)name.size(), pool.size(),
+                                   catalog[i].getPrice().getCents()};
+        pool.append(name);
+
+        size_t mask = slots - 1;
+        size_t probe = IdIndex::hashKey(catalog[i].getId()) & mask;
+        while (index[probe] != 0 && records[index[probe] - 1].id != catalog[i].getId())
+        {
+            probe = (probe + 1) & mask;
+        }
+        index[probe] = (unsigned int)i + 1;
+    }
+    header.stringsLength = pool.size();
+
+    string tmpPath = path + ".tmp";
+    FILE *out = fopen(tmpPath.c_str(), "wb");
+    if (!out)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(records.data(), sizeof(CatalogRecord), records.size(), out) == records.size() &&
+              fwrite(index.data(), sizeof(unsigned int), index.size(), out) == index.size() &&
+              fwrite(pool.data(), 1, pool.size(), out) == pool.size();
+    ok = fclose(out) == 0 && ok;
+    error_code ec;
+    if (ok)
+        filesystem::rename(tmpPath, path, ec);
+    if (!ok || ec)
+    {
+        filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
+
+// Versioned catalog for live updates under read-mostly load. Readers take an
+// immutable snapshot and never wait on writers; a writer copies the current
+// version, edits the copy and publishes it in one atomic store. A snapshot
+// stays valid for as long as someone holds it. snapshot() itself may briefly
+// take a library lock (atomic shared_ptr access), so hot readers go through a
+// Reader, which only reloads when the version changes.
+class VersionedCatalog
+{
+private:
+    shared_ptr<const ProductCatalog> current; // only touched through atomic_load/atomic_store
+    atomic<unsigned long long> version;
+    mutex writeLock; // serializes writers; readers never take it
+
+public:
+    explicit VersionedCatalog(const ProductCatalog &initial)
+        : current(make_shared<const ProductCatalog>(initial)), version(1)
+    {
+    }
+
+    VersionedCatalog(const VersionedCatalog &) = delete;
+    VersionedCatalog &operator=(const VersionedCatalog &) = delete;
+
+    shared_ptr<const ProductCatalog> snapshot() const { return atomic_load(&current); }
+    unsigned long long getVersion() const { return version.load(memory_order_acquire); }
+
+    // Applies edit(ProductCatalog &) to a copy and publishes it; returns the new version
+    template <typename Edit>
+    unsigned long long update(Edit edit)
+    {
+        lock_guard<mutex> guard(writeLock);
+        shared_ptr<ProductCatalog> next = make_shared<ProductCatalog>(*atomic_load(&current));
+        edit(*next);
+        atomic_store(&current, shared_ptr<const ProductCatalog>(std::move(next)));
+        return version.fetch_add(1, memory_order_release) + 1;
+    }
+
+    bool setPrice(int id, Money price)
+    {
+        bool found = false;
+        update([&](ProductCatalog &catalog)
+               { found = catalog.setPrice(id, price); });
+        return found;
+    }
+
+    void reprice(int changeBasisPoints)
+    {
+        update([=](ProductCatalog &catalog)
+               { catalog.reprice(changeBasisPoints); });
+    }
+
+    // Per-thread reader that keeps its snapshot until a new version is
+    // published, so repeated lookups cost one atomic load of the version
+    class Reader
+    {
+    private:
+        const VersionedCatalog &source;
+        shared_ptr<const ProductCatalog> cached;
+        unsigned long long cachedVersion;
+
+    public:
+        explicit Reader(const VersionedCatalog &catalog) : source(catalog), cachedVersion(0) {}
+
+        const ProductCatalog &get() { return *pin(); }
+
+        // The current snapshot, kept alive by the returned pointer
+        const shared_ptr<const ProductCatalog> &pin()
+        {
+            unsigned long long latest = source.getVersion();
+            if (latest != cachedVersion)
+            {
+                cached = source.snapshot();
+                cachedVersion = latest;
+            }
+            return cached;
+        }
+    };
+};
+
+// One page of name search results, best match first
+struct SearchPage
+{
+    vector<const Product *> products;
+    size_t totalMatches;
+};
+
+// Case-insensitive substring search over product names. Every 1-, 2- and
+// 3-character gram of each name is posted once per product; a query walks
+// the shortest posting list among its grams and checks each candidate, so
+// the work follows the number of near-matches, not the catalog size.
+// Postings hold product IDs, so the index stays valid across price updates;
+// it is rebuilt when a search sees a catalog whose names have changed.
+class ProductSearchIndex
+{
+private:
+    struct Postings
+    {
+        unsigned long long namesVersion; // of the catalog that was indexed
+        vector<unsigned int> grams;      // sorted gram keys
+        vector<size_t> postingStart;     // grams[i] posts ids[postingStart[i] .. postingStart[i + 1])
+        vector<int> ids;
+
+        // Returns the posting list for a gram as [begin, end) into ids
+        pair<size_t, size_t> find(unsigned int key) const
+        {
+            vector<unsigned int>::const_iterator it = lower_bound(grams.begin(), grams.end(), key);
+            if (it == grams.end() || *it != key)
+                return make_pair((size_t)0, (size_t)0);
+            size_t i = it - grams.begin();
+            return make_pair(postingStart[i], postingStart[i + 1]);
+        }
+    };
+
+    shared_ptr<const Postings> current; // only touched through atomic_load/atomic_store
+    mutex buildLock;                    // one rebuild at a time; searches never take it
+
+    static char fold(char c) { return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c; }
+
+    // Length in the top byte, so grams of different lengths never collide
+    static unsigned int gramKey(const char *text, size_t length)
+    {
+        unsigned int key = (unsigned int)length << 24;
+        for (size_t i = 0; i < length; i++)
+        {
+            key |= (unsigned int)(unsigned char)fold(text[i]) << (8 * (2 - i));
+        }
+        return key;
+    }
+
+    // 0 exact, 1 name prefix, 2 word prefix, 3 elsewhere; -1 if absent
+    static int matchRank(string_view name, const string &needle)
+    {
+        int best = -1;
+        for (size_t at = 0; at + needle.size() <= name.size() && best != 0 && best != 1; at++)
+        {
+            size_t i = 0;
+            while (i < needle.size() && fold(name[at + i]) == needle[i])
+            {
+                i++;
+            }
+            if (i < needle.size())
+                continue;
+            int rank = at == 0 ? (needle.size() == name.size() ? 0 : 1) : (name[at - 1] == ' ' ? 2 : 3);
+            if (best < 0 || rank < best)
+                best = rank;
+        }
+        return best;
+    }
+
+    static shared_ptr<const Postings> index(const ProductCatalog &catalog)
+    {
+        vector<pair<unsigned int, int>> entries;
+        for (size_t i = 0; i < catalog.size(); i++)
+        {
+            // Names are read in place, so a mapped image is not materialized
+            string_view name = catalog.nameAt(i);
+            int id = catalog.idAt(i);
+            for (size_t n = 1; n <= 3; n++)
+            {
+                for (size_t at = 0; at + n <= name.size(); at++)
+                {
+                    entries.push_back(make_pair(gramKey(name.data() + at, n), id));
+                }
+            }
+        }
+        sort(entries.begin(), entries.end());
+        entries.erase(unique(entries.begin(), entries.end()), entries.end());
+
+        shared_ptr<Postings> built = make_shared<Postings>();
+        built->namesVersion = catalog.namesVersion();
+        built->ids.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (built->grams.empty() || built->grams.back() != entries[i].first)
+            {
+                built->grams.push_back(entries[i].first);
+                built->postingStart.push_back(built->ids.size());
+            }
+            built->ids.push_back(entries[i].second);
+        }
+        built->postingStart.push_back(built->ids.size());
+        return built;
+    }
+
+public:
+    ProductSearchIndex() {}
+    ProductSearchIndex(const ProductSearchIndex &) = delete;
+    ProductSearchIndex &operator=(const ProductSearchIndex &) = delete;
+
+    // Indexes the catalog's names unless they are already indexed. search()
+    // calls it too, so a mapped catalog is only scanned once someone searches.
+    shared_ptr<const Postings> build(const ProductCatalog &catalog)
+    {
+        shared_ptr<const Postings> indexed = atomic_load(&current);
+        if (indexed && indexed->namesVersion == catalog.namesVersion())
+            return indexed;
+        lock_guard<mutex> guard(buildLock);
+        indexed = atomic_load(&current);
+        if (!indexed || indexed->namesVersion != catalog.namesVersion())
+        {
+            indexed = index(catalog);
+            atomic_store(&current, indexed);
+        }
+        return indexed;
+    }
+
+    // Matches ordered by rank, then shorter name, then ID; an empty query matches nothing
+    SearchPage search(const ProductCatalog &catalog, string_view text, size_t offset, size_t limit)
+    {
+        SearchPage page;
+        page.totalMatches = 0;
+        if (text.empty())
+            return page;
+        shared_ptr<const Postings> postings = build(catalog);
+        const vector<int> &ids = postings->ids;
+
+        string needle(text.size(), ' ');
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            needle[i] = fold(text[i]);
+        }
+
+        // The rarest gram of the query bounds the candidates
+        size_t gramLength = needle.size() < 3 ? needle.size() : 3;
+        pair<size_t, size_t> best = postings->find(gramKey(needle.data(), gramLength));
+        for (size_t at = 1; at + gramLength <= needle.size() && best.first != best.second; at++)
+        {
+            pair<size_t, size_t> candidate = postings->find(gramKey(needle.data() + at, gramLength));
+            if (candidate.second - candidate.first < best.second - best.first)
+                best = candidate;
+        }
+
+        struct Match
+        {
+            int rank;
+            size_t length;
+            int id;
+            bool operator<(const Match &other) const
+            {
+                if (rank != other.rank)
+                    return rank < other.rank;
+                if (length != other.length)
+                    return length < other.length;
+                return id < other.id;
+            }
+        };
+        vector<Match> matches;
+        // Candidates are ranked by name alone; only the returned page is built as Products
+        for (size_t i = best.first; i < best.second; i++)
+        {
+            string_view name;
+            int rank = catalog.findName(ids[i], name) ? matchRank(name, needle) : -1;
+            if (rank >= 0)
+                matches.push_back(Match{rank, name.size(), ids[i]});
+        }
+
+        page.totalMatches = matches.size();
+        if (offset >= matches.size())
+            return page;
+        size_t end = offset + limit < matches.size() ? offset + limit : matches.size();
+        partial_sort(matches.begin(), matches.begin() + end, matches.end());
+        for (size_t i = offset; i < end; i++)
+        {
+            page.products.push_back(catalog.find(matches[i].id));
+        }
+        return page;
+    }
+};
+
+// Inventory: stock per product ID, reserved while units sit in a cart.
+// Each SKU's stock is split across cache-line-sized stripes and a thread
+// reserves from its own stripe first, so shoppers hammering one hot product
+// rarely touch the same counter. Products never given a stock level are
+// untracked and can always be reserved.
+class Inventory
+{
+private:
+    static const int STRIPES = 4;
+
+    struct alignas(64) Stripe
+    {
+        atomic<int> available;
+        atomic<int> sold;
+    };
+
+    struct Stock
+    {
+        Stripe stripes[STRIPES];
+    };
+
+    deque<Stock> stock; // never reallocates, so stripes stay put
+    IdIndex index;      // product ID -> position in stock
+
+    static int homeStripe()
+    {
+        static atomic<int> nextStripe(0);
+        thread_local int stripe = nextStripe.fetch_add(1, memory_order_relaxed) % STRIPES;
+        return stripe;
+    }
+
+    Stock *stockFor(int productId)
+    {
+        int slot = index.find(productId);
+        return slot >= 0 ? &stock[slot] : nullptr;
+    }
+
+    // Takes up to units from one stripe and returns how many it got
+    static int take(Stripe &stripe, int units)
+    {
+        int available = stripe.available.load(memory_order_relaxed);
+        while (available > 0)
+        {
+            int taken = available < units ? available : units;
+            if (stripe.available.compare_exchange_weak(available, available - taken, memory_order_acq_rel,
+                                                       memory_order_relaxed))
+                return taken;
+        }
+        return 0;
+    }
+
+public:
+    Inventory() {}
+    Inventory(const Inventory &) = delete;
+    Inventory &operator=(const Inventory &) = delete;
+
+    // Sets a product's unreserved stock; call before shoppers start
+    void setStock(int productId, int units)
+    {
+        Stock *entry = stockFor(productId);
+        if (!entry)
+        {
+            index.insert(productId, (int)stock.size());
+            stock.emplace_back();
+            entry = &stock.back();
+        }
+        for (int i = 0; i < STRIPES; i++)
+        {
+            entry->stripes[i].available.store(units / STRIPES + (i < units % STRIPES ? 1 : 0));
+            entry->stripes[i].sold.store(0);
+        }
+    }
+
+    bool isTracked(int productId) const { return index.find(productId) >= 0; }
+
+    // Reserves units for a cart; all or nothing
+    bool reserve(int productId, int units)
+    {
+        Stock *entry = stockFor(productId);
+        if (!entry || units <= 0)
+            return true;
+        int home = homeStripe();
+        int got = take(entry->stripes[home], units);
+        for (int i = 1; got < units && i < STRIPES; i++)
+        {
+            got += take(entry->stripes[(home + i) % STRIPES], units - got);
+        }
+        if (got < units)
+        {
+            entry->stripes[home].available.fetch_add(got, memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Returns reserved units to the shelf (cart cleared or line reduced)
+    void release(int productId, int units)
+    {
+        Stock *entry = stockFor(productId);
+        if (entry && units > 0)
+            entry->stripes[homeStripe()].available.fetch_add(units, memory_order_relaxed);
+    }
+
+    // Turns reserved units into sold ones at checkout
+    void commit(int productId, int units)
+    {
+        Stock *entry = stockFor(productId);
+        if (entry && units > 0)
+            entry->stripes[homeStripe()].sold.fetch_add(units, memory_order_relaxed);
+    }
+
+    // Unreserved units; -1 for untracked products
+    int available(int productId)
+    {
+        Stock *entry = stockFor(productId);
+        if (!entry)
+            return -1;
+        int total = 0;
+        for (int i = 0; i < STRIPES; i++)
+        {
+            total += entry->stripes[i].available.load(memory_order_relaxed);
+        }
+        return total;
+    }
+
+    int sold(int productId)
+    {
+        Stock *entry = stockFor(productId);
+        if (!entry)
+            return 0;
+        int total = 0;
+        for (int i = 0; i < STRIPES; i++)
+        {
+            total += entry->stripes[i].sold.load(memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+// Shopping Cart Item class
+class CartItem
+{
+private:
+    Product product;
+    int quantity;
+
+public:
+    CartItem(const Product &product, int quantity) : product(product), quantity(quantity) {}
+
+    const Product &getProduct() const { return product; }
+    int getQuantity() const { return quantity; }
+    void setQuantity(int qty) { quantity = qty; }
+    void setUnitPrice(Money price) { product.setPrice(price); }
+    Money getTotalPrice() const { return product.getPrice() * quantity; }
+};
+
+// Payment Strategy Interface
+class PaymentStrategy
+{
+public:
+    virtual ~PaymentStrategy() {}
+    virtual void pay(Money amount) = 0;
+    virtual string getMethodName() const = 0;
+    // Called once at registration to open connections or load warm state
+    virtual void warmUp() {}
+};
+
+// Concrete Payment Strategies (final, so calls through the concrete type are devirtualized)
+class CashPayment final : public PaymentStrategy
+{
+public:
+    static constexpr string_view METHOD_NAME = "Cash";
+    void pay(Money amount) override {}
+    string getMethodName() const override { return string(METHOD_NAME); }
+};
+
+class CardPayment final : public PaymentStrategy
+{
+public:
+    static constexpr string_view METHOD_NAME = "Credit/Debit Card";
+    void pay(Money amount) override {}
+    string getMethodName() const override { return string(METHOD_NAME); }
+};
+
+class GCashPayment final : public PaymentStrategy
+{
+public:
+    static constexpr string_view METHOD_NAME = "GCash";
+    void pay(Money amount) override {}
+    string getMethodName() const override { return string(METHOD_NAME); }
+};
+
+// Static dispatch over the built-in strategies: std::visit calls pay() on the
+// concrete final type, so the call is inlined and names need no allocation
+typedef variant<CashPayment, CardPayment, GCashPayment> BuiltinPayment;
+
+inline void payBuiltin(BuiltinPayment &method, Money amount)
+{
+    visit([amount](auto &m)
+          { m.pay(amount); },
+          method);
+}
+
+constexpr string_view builtinMethodName(const BuiltinPayment &method)
+{
+    return visit([](const auto &m)
+                 { return decay_t<decltype(m)>::METHOD_NAME; },
+                 method);
+}
+
+// Payment registry: one long-lived instance per method, resolved by ID.
+// Built-in methods are held by value and dispatched statically; plugins
+// registered as PaymentStrategy objects go through the virtual interface.
+class PaymentRegistry
+{
+private:
+    struct Entry
+    {
+        bool isBuiltin;
+        BuiltinPayment builtin;
+        unique_ptr<PaymentStrategy> plugin;
+        string pluginName; // cached so lookups need not call getMethodName()
+
+        Entry() : isBuiltin(false) {}
+    };
+
+    vector<Entry> entries; // indexed by method ID
+
+    Entry &slotFor(int id)
+    {
+        if (id < 0)
+            throw InvalidPaymentMethodException();
+        if ((size_t)id >= entries.size())
+        {
+            entries.resize(id + 1);
+        }
+        return entries[id];
+    }
+
+    const Entry *entryFor(int id) const
+    {
+        if (id < 0 || (size_t)id >= entries.size() || !(entries[id].isBuiltin || entries[id].plugin))
+            return nullptr;
+        return &entries[id];
+    }
+
+public:
+    // Takes ownership; replaces any strategy already registered under id
+    void registerStrategy(int id, unique_ptr<PaymentStrategy> strategy)
+    {
+        Entry &entry = slotFor(id);
+        strategy->warmUp();
+        entry.isBuiltin = false;
+        entry.pluginName = strategy->getMethodName();
+        entry.plugin = std::move(strategy);
+    }
+
+    void registerBuiltin(int id, const BuiltinPayment &method)
+    {
+        Entry &entry = slotFor(id);
+        entry.isBuiltin = true;
+        entry.builtin = method;
+        entry.plugin.reset();
+        visit([](auto &m)
+              { m.warmUp(); },
+              entry.builtin);
+    }
+
+    // Returns nullptr for unknown IDs; never allocates
+    PaymentStrategy *find(int id)
+    {
+        const Entry *entry = entryFor(id);
+        if (!entry)
+            return nullptr;
+        if (entry->plugin)
+            return entry->plugin.get();
+        return visit([](auto &m) -> PaymentStrategy *
+                     { return &m; },
+                     entries[id].builtin);
+    }
+
+    PaymentStrategy &resolve(int id)
+    {
+        PaymentStrategy *strategy = find(id);
+        if (!strategy)
+            throw InvalidPaymentMethodException();
+        return *strategy;
+    }
+
+    bool contains(int id) const { return entryFor(id) != nullptr; }
+
+    // Pays through the static path for built-ins, virtually for plugins
+    ErrorCode tryPay(int id, Money amount)
+    {
+        if (!contains(id))
+            return ErrorCode::InvalidPaymentMethod;
+        ScopedTimer timer(Metric::Payment);
+        Entry &entry = entries[id];
+        if (entry.isBuiltin)
+        {
+            payBuiltin(entry.builtin, amount);
+        }
+        else
+        {
+            entry.plugin->pay(amount);
+        }
+        return ErrorCode::None;
+    }
+
+    void pay(int id, Money amount)
+    {
+        if (tryPay(id, amount) != ErrorCode::None)
+            throw InvalidPaymentMethodException();
+    }
+
+    // Name of a registered method; built-in names are compile-time constants
+    string_view methodName(int id) const
+    {
+        const Entry *entry = entryFor(id);
+        if (!entry)
+            throw InvalidPaymentMethodException();
+        return entry->isBuiltin ? builtinMethodName(entry->builtin) : string_view(entry->pluginName);
+    }
+
+    // IDs run from 0 to maxId(); gaps are reported by contains()
+    int maxId() const { return (int)entries.size() - 1; }
+};
+
+// Registers the built-in payment methods under their menu numbers
+void registerBuiltinPayments(PaymentRegistry &registry)
+{
+    registry.registerBuiltin(1, CashPayment());
+    registry.registerBuiltin(2, CardPayment());
+    registry.registerBuiltin(3, GCashPayment());
+}
+
+// Outcome of one asynchronous authorization
+struct PaymentResult
+{
+    bool approved;
+    const char *declineReason; // static text, nullptr when approved
+};
+
+// Payment gateway that authorizes many payments per network round-trip
+class PaymentGateway
+{
+public:
+    virtual ~PaymentGateway() {}
+    // Fills results[i] for amounts[i]; called from the dispatcher's lane thread
+    virtual void authorizeBatch(const vector<Money> &amounts, vector<PaymentResult> &results) = 0;
+};
+
+// Runs an in-process PaymentStrategy behind the gateway interface
+class StrategyGateway : public PaymentGateway
+{
+private:
+    PaymentStrategy &strategy;
+
+public:
+    explicit StrategyGateway(PaymentStrategy &s) : strategy(s) {}
+
+    void authorizeBatch(const vector<Money> &amounts, vector<PaymentResult> &results) override
+    {
+        for (size_t i = 0; i < amounts.size(); i++)
+        {
+            ScopedTimer timer(Metric::Payment);
+            strategy.pay(amounts[i]);
+            results[i] = PaymentResult{true, nullptr};
+        }
+    }
+};
+
+// Asynchronous payment dispatcher. Each gateway gets a lane with its own
+// thread that coalesces queued authorizations into batches, so callers only
+// take a short queue lock and never wait for the gateway round-trip.
+class PaymentDispatcher
+{
+public:
+    typedef function<void(const PaymentResult &)> Completion;
+
+private:
+    struct Lane
+    {
+        PaymentGateway *gateway;
+        size_t maxBatch;               // largest batch sent in one round-trip
+        chrono::milliseconds maxDelay; // how long a partial batch may wait to fill
+        mutex lock;
+        condition_variable ready;
+        vector<Money> pendingAmounts;
+        vector<Completion> pendingCallbacks;
+        bool stopping;
+        thread worker;
+    };
+
+    vector<unique_ptr<Lane>> lanes;
+
+    static void run(Lane *lane)
+    {
+        vector<Money> amounts;
+        vector<Completion> callbacks;
+        vector<PaymentResult> results;
+        while (true)
+        {
+            {
+                unique_lock<mutex> guard(lane->lock);
+                lane->ready.wait(guard, [lane]
+                                 { return lane->stopping || !lane->pendingAmounts.empty(); });
+                if (lane->pendingAmounts.empty())
+                    return; // stopping with nothing left to authorize
+                // Give a partial batch a short window to fill up
+                lane->ready.wait_for(guard, lane->maxDelay, [lane]
+                                     { return lane->stopping || lane->pendingAmounts.size() >= lane->maxBatch; });
+                size_t take = min(lane->pendingAmounts.size(), lane->maxBatch);
+                amounts.assign(lane->pendingAmounts.begin(), lane->pendingAmounts.begin() + take);
+                lane->pendingAmounts.erase(lane->pendingAmounts.begin(), lane->pendingAmounts.begin() + take);
+                callbacks.assign(make_move_iterator(lane->pendingCallbacks.begin()),
+                                 make_move_iterator(lane->pendingCallbacks.begin() + take));
+                lane->pendingCallbacks.erase(lane->pendingCallbacks.begin(), lane->pendingCallbacks.begin() + take);
+            }
+            results.assign(amounts.size(), PaymentResult{false, "Gateway did not respond"});
+            lane->gateway->authorizeBatch(amounts, results);
+            for (size_t i = 0; i < callbacks.size(); i++)
+            {
+                callbacks[i](results[i]);
+            }
+            amounts.clear();
+            callbacks.clear();
+        }
+    }
+
+public:
+    PaymentDispatcher() {}
+    PaymentDispatcher(const PaymentDispatcher &) = delete;
+    PaymentDispatcher &operator=(const PaymentDispatcher &) = delete;
+    ~PaymentDispatcher() { shutdown(); }
+
+    // Registers a gateway and returns its lane ID for submit()
+    int addGateway(PaymentGateway &gateway, size_t maxBatch = 64, int maxDelayMs = 2)
+    {
+        unique_ptr<Lane> lane(new Lane());
+        lane->gateway = &gateway;
+        lane->maxBatch = maxBatch;
+        lane->maxDelay = chrono::milliseconds(maxDelayMs);
+        lane->stopping = false;
+        lane->worker = thread(&PaymentDispatcher::run, lane.get());
+        lanes.push_back(std::move(lane));
+        return (int)lanes.size() - 1;
+    }
+
+    // Queues an authorization; onComplete runs on the lane thread. After
+    // shutdown() the payment is declined at once, on the calling thread.
+    void submit(int gatewayId, Money amount, Completion onComplete)
+    {
+        Lane &lane = *lanes.at(gatewayId);
+        bool queued;
+        {
+            lock_guard<mutex> guard(lane.lock);
+            queued = !lane.stopping;
+            if (queued)
+            {
+                lane.pendingAmounts.push_back(amount);
+                lane.pendingCallbacks.push_back(std::move(onComplete));
+            }
+        }
+        if (!queued)
+        {
+            onComplete(PaymentResult{false, "Payment service is shut down"});
+            return;
+        }
+        lane.ready.notify_one();
+    }
+
+    future<PaymentResult> submit(int gatewayId, Money amount)
+    {
+        shared_ptr<promise<PaymentResult>> result = make_shared<promise<PaymentResult>>();
+        future<PaymentResult> pending = result->get_future();
+        submit(gatewayId, amount, [result](const PaymentResult &r)
+               { result->set_value(r); });
+        return pending;
+    }
+
+    // Authorizes everything already queued, then stops all lane threads
+    void shutdown()
+    {
+        for (size_t i = 0; i < lanes.size(); i++)
+        {
+            {
+                lock_guard<mutex> guard(lanes[i]->lock);
+                lanes[i]->stopping = true;
+            }
+            lanes[i]->ready.notify_one();
+        }
+        for (size_t i = 0; i < lanes.size(); i++)
+        {
+            if (lanes[i]->worker.joinable())
+            {
+                lanes[i]->worker.join();
+            }
+        }
+    }
+};
+
+// Shopping Cart class (one per shopper session, see CartManager)
+class ShoppingCart
+{
+private:
+    vector<CartItem> items; // capacity is kept across clearCart() for reuse
+    IdIndex itemIndex;      // product ID -> position in items
+
+    // Structure-of-arrays pricing columns, parallel to items
+    vector<long long> unitCents;
+    vector<int> quantities;
+
+    // Maintained on every mutation so views and checkout need no re-summing
+    Money runningTotal;
+    int unitCount;
+
+    Inventory *inventory; // optional; units in the cart are reserved in it
+
+    enum StockAction
+    {
+        RELEASE_STOCK, // cart abandoned or cleared
+        COMMIT_STOCK,  // cart paid for
+        KEEP_RESERVED  // lines handed to a pending checkout
+    };
+
+    // Empties the cart and settles the reservations of its lines
+    void reset(StockAction action)
+    {
+        if (inventory && action != KEEP_RESERVED)
+        {
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                if (action == COMMIT_STOCK)
+                    inventory->commit(items[i].getProduct().getId(), quantities[i]);
+                else
+                    inventory->release(items[i].getProduct().getId(), quantities[i]);
+            }
+        }
+        items.clear();
+        unitCents.clear();
+        quantities.clear();
+        itemIndex.clear();
+        runningTotal = Money();
+        unitCount = 0;
+    }
+
+public:
+    explicit ShoppingCart(Inventory *stock = nullptr) : unitCount(0), inventory(stock)
+    {
+        items.reserve(10);
+        unitCents.reserve(items.capacity());
+        quantities.reserve(items.capacity());
+        itemIndex.reserve(items.capacity());
+    }
+
+    ShoppingCart(const ShoppingCart &) = delete;
+    ShoppingCart &operator=(const ShoppingCart &) = delete;
+
+    // An abandoned cart gives its reserved units back
+    ~ShoppingCart() { reset(RELEASE_STOCK); }
+
+    // Process-wide default cart for single-shopper callers
+    static ShoppingCart *getInstance()
+    {
+        static ShoppingCart instance;
+        return &instance;
+    }
+
+    // Throws OutOfStockException if the units cannot be reserved
+    void addProduct(const Product &product, int quantity = 1)
+    {
+        ErrorCode added = tryAddProduct(product, quantity);
+        if (added != ErrorCode::None)
+            throw OutOfStockException();
+    }
+
+    ErrorCode tryAddProduct(const Product &product, int quantity = 1)
+    {
+        ScopedTimer timer(Metric::CartAdd);
+        if (inventory && !inventory->reserve(product.getId(), quantity))
+            return ErrorCode::OutOfStock;
+        insertLine(product, quantity);
+        return ErrorCode::None;
+    }
+
+private:
+    // Adds units whose stock is already reserved
+    void insertLine(const Product &product, int quantity)
+    {
+        int slot = itemIndex.find(product.getId());
+        if (slot >= 0)
+        {
+            // The merged line takes the price it was just added at, so the
+            // running total stays in step with the line if the price changed
+            runningTotal -= Money::fromCents(unitCents[slot]) * quantities[slot];
+            items[slot].setUnitPrice(product.getPrice());
+            items[slot].setQuantity(items[slot].getQuantity() + quantity);
+            unitCents[slot] = product.getPrice().getCents();
+            quantities[slot] += quantity;
+            runningTotal += product.getPrice() * quantities[slot];
+            unitCount += quantity;
+            return;
+        }
+
+        if (items.size() == items.capacity())
+        {
+            items.reserve(items.capacity() * 2);
+            unitCents.reserve(items.capacity());
+            quantities.reserve(items.capacity());
+            itemIndex.reserve(items.capacity());
+        }
+
+        itemIndex.insert(product.getId(), (int)items.size());
+        items.emplace_back(product, quantity);
+        unitCents.push_back(product.getPrice().getCents());
+        quantities.push_back(quantity);
+        runningTotal += product.getPrice() * quantity;
+        unitCount += quantity;
+    }
+
+public:
+    // Changes the quantity of a line already in the cart; 0 or less removes it.
+    // Returns false if the product is not in the cart, and throws
+    // OutOfStockException if a larger quantity cannot be reserved.
+    bool setQuantity(int productId, int quantity)
+    {
+        int slot = itemIndex.find(productId);
+        if (slot < 0)
+            return false;
+
+        int newQuantity = quantity > 0 ? quantity : 0;
+        if (inventory)
+        {
+            if (newQuantity > quantities[slot])
+            {
+                if (!inventory->reserve(productId, newQuantity - quantities[slot]))
+                    throw OutOfStockException();
+            }
+            else
+            {
+                inventory->release(productId, quantities[slot] - newQuantity);
+            }
+        }
+
+        Money unitPrice = Money::fromCents(unitCents[slot]);
+        runningTotal -= unitPrice * quantities[slot];
+        unitCount -= quantities[slot];
+        if (quantity > 0)
+        {
+            items[slot].setQuantity(quantity);
+            quantities[slot] = quantity;
+            runningTotal += unitPrice * quantity;
+            unitCount += quantity;
+            return true;
+        }
+
+        // Remove by moving the last line into the freed slot
+        int last = (int)items.size() - 1;
+        itemIndex.erase(productId);
+        if (slot != last)
+        {
+            items[slot] = std::move(items[last]);
+            unitCents[slot] = unitCents[last];
+            quantities[slot] = quantities[last];
+            itemIndex.insert(items[slot].getProduct().getId(), slot);
+        }
+        items.pop_back();
+        unitCents.pop_back();
+        quantities.pop_back();
+        return true;
+    }
+
+    void renderCart(TableRenderer &out) const
+    {
+        if (items.empty())
+        {
+            out.text("Your shopping cart is empty.\n");
+            return;
+        }
+
+        out.text("\nShopping Cart:\n");
+        out.text("---------------------------------------------------------\n");
+        out.left("ID", ID_WIDTH + 2).left("Name", NAME_WIDTH).column("Price", PRICE_WIDTH);
+        out.column("Qty", QTY_WIDTH).column("Total", LINE_TOTAL_WIDTH).text("\n");
+        out.text("---------------------------------------------------------\n");
+
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            const Product &p = items[i].getProduct();
+            out.right(p.getId(), ID_WIDTH).text("  ").left(p.getName(), NAME_WIDTH).column(p.getPrice(), PRICE_WIDTH);
+            out.column(items[i].getQuantity(), QTY_WIDTH).column(items[i].getTotalPrice(), LINE_TOTAL_WIDTH).text("\n");
+        }
+
+        out.text("---------------------------------------------------------\n");
+        out.text("Total: ").money(runningTotal).text("\n");
+        out.text("---------------------------------------------------------\n");
+    }
+
+    void displayCart() const
+    {
+        TableRenderer &out = TableRenderer::shared();
+        renderCart(out);
+        out.flushTo(cout);
+    }
+
+    Money getTotalAmount() const
+    {
+        ScopedTimer timer(Metric::CartTotal);
+        if (items.empty())
+            throw EmptyCartException();
+        return runningTotal;
+    }
+
+    Expected<Money> tryGetTotalAmount() const
+    {
+        ScopedTimer timer(Metric::CartTotal);
+        if (items.empty())
+            return ErrorCode::EmptyCart;
+        return runningTotal;
+    }
+
+    // Re-prices every line from one catalog snapshot. Fails without changing
+    // anything if a product in the cart is no longer in the catalog.
+    ErrorCode repriceFrom(const ProductCatalog &catalog)
+    {
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            if (!catalog.find(items[i].getProduct().getId()))
+                return ErrorCode::InvalidId;
+        }
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            Money price = catalog.find(items[i].getProduct().getId())->getPrice();
+            items[i].setUnitPrice(price);
+            unitCents[i] = price.getCents();
+        }
+        runningTotal = recomputeTotal();
+        return ErrorCode::None;
+    }
+
+    // Re-sums the pricing columns; used to cross-check the running total
+    Money recomputeTotal() const
+    {
+        return Money::fromCents(PricingEngine::cartTotal(unitCents.data(), quantities.data(), unitCents.size()));
+    }
+
+    void clearCart() { reset(RELEASE_STOCK); }
+
+    // Empties a cart that has just been paid for; its reserved units are sold
+    void completeCheckout() { reset(COMMIT_STOCK); }
+
+    // Moves the lines, still reserved, to a checkout awaiting payment
+    void handOff(vector<CartItem> &lines)
+    {
+        lines.assign(items.begin(), items.end());
+        reset(KEEP_RESERVED);
+    }
+
+    // Puts handed-off lines back after a declined payment
+    void restore(const vector<CartItem> &lines)
+    {
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            insertLine(lines[i].getProduct(), lines[i].getQuantity());
+        }
+    }
+
+    Inventory *getInventory() const { return inventory; }
+
+    bool isEmpty() const
+    {
+        return items.empty();
+    }
+
+    const vector<CartItem> &getItems() const { return items; }
+    int getItemCount() const { return (int)items.size(); }
+    int getUnitCount() const { return unitCount; }
+};
+
+// Cart manager: per-session carts in a sharded map, locked per session
+class CartManager
+{
+private:
+    struct Session
+    {
+        mutex lock;
+        ShoppingCart cart;
+
+        explicit Session(Inventory *stock) : cart(stock) {}
+    };
+
+    // Each shard only guards its own map; cart access uses the session lock
+    struct alignas(64) Shard
+    {
+        mutex lock;
+        unordered_map<unsigned long long, shared_ptr<Session>> sessions;
+    };
+
+    static const size_t SHARD_COUNT = 64;
+    Shard shards[SHARD_COUNT];
+    Inventory *inventory; // handed to every new cart
+
+    Shard &shardFor(unsigned long long sessionId)
+    {
+        return shards[(sessionId * 0x9E3779B97F4A7C15ull >> 32) % SHARD_COUNT];
+    }
+
+public:
+    explicit CartManager(Inventory *stock = nullptr) : inventory(stock) {}
+
+    // Exclusive access to one session's cart for as long as the handle lives
+    class CartHandle
+    {
+    private:
+        shared_ptr<Session> session;
+        unique_lock<mutex> guard;
+
+        explicit CartHandle(shared_ptr<Session> s) : session(move(s)), guard(session->lock) {}
+        friend class CartManager;
+
+    public:
+        ShoppingCart *operator->() const { return &session->cart; }
+        ShoppingCart &operator*() const { return session->cart; }
+    };
+
+    // Locks the session's cart, creating an empty cart for a new session
+    CartHandle acquire(unsigned long long sessionId)
+    {
+        Shard &shard = shardFor(sessionId);
+        shared_ptr<Session> session;
+        {
+            lock_guard<mutex> shardGuard(shard.lock);
+            shared_ptr<Session> &slot = shard.sessions[sessionId];
+            if (!slot)
+            {
+                slot = make_shared<Session>(inventory);
+            }
+            session = slot;
+        }
+        return CartHandle(move(session));
+    }
+
+    // Forgets a session; a handle still held elsewhere keeps its cart alive
+    bool endSession(unsigned long long sessionId)
+    {
+        Shard &shard = shardFor(sessionId);
+        lock_guard<mutex> shardGuard(shard.lock);
+        return shard.sessions.erase(sessionId) > 0;
+    }
+
+    size_t sessionCount()
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < SHARD_COUNT; i++)
+        {
+            lock_guard<mutex> shardGuard(shards[i].lock);
+            total += shards[i].sessions.size();
+        }
+        return total;
+    }
+};
+
+// Append-only storage in fixed-size chunks; elements never move once added.
+// emplace_back may be called from many threads at once and works as an
+// ordered-commit queue: claiming a slot and constructing the element take no
+// lock, but publication happens strictly in slot order, so size() and
+// operator[] always see a gap-free, fully constructed prefix and an element is
+// visible by the time emplace_back returns. The price is that publishing is
+// not lock-free: a writer that stalls between claim and publish holds up every
+// later writer until it resumes.
+template <typename T>
+class ChunkedStore
+{
+private:
+    static const size_t CHUNK_SIZE = 1024;
+    static const size_t PAGE_SIZE = 1024; // chunk pointers per directory page
+    static const size_t MAX_PAGES = 4096; // 4G elements, more than any int order ID
+
+    // Two-level directory: pages of chunk pointers are installed on demand,
+    // so readers never race with a growing vector and there is no small cap
+    struct Page
+    {
+        atomic<T *> chunks[PAGE_SIZE];
+
+        Page()
+        {
+            for (size_t i = 0; i < PAGE_SIZE; i++)
+            {
+                chunks[i].store(nullptr, memory_order_relaxed);
+            }
+        }
+    };
+
+    unique_ptr<atomic<Page *>[]> pages;
+    atomic<size_t> reserved;
+    atomic<size_t> committed;
+
+    T *chunkAt(size_t c) const
+    {
+        return pages[c / PAGE_SIZE].load(memory_order_acquire)->chunks[c % PAGE_SIZE].load(memory_order_acquire);
+    }
+
+    T *chunkFor(size_t index)
+    {
+        size_t c = index / CHUNK_SIZE;
+        atomic<Page *> &pageSlot = pages[c / PAGE_SIZE];
+        Page *page = pageSlot.load(memory_order_acquire);
+        if (!page)
+        {
+            // Several writers may race to install a page or chunk; the losers free theirs
+            Page *fresh = new Page();
+            if (pageSlot.compare_exchange_strong(page, fresh, memory_order_acq_rel, memory_order_acquire))
+                page = fresh;
+            else
+                delete fresh;
+        }
+        atomic<T *> &chunkSlot = page->chunks[c % PAGE_SIZE];
+        T *chunk = chunkSlot.load(memory_order_acquire);
+        if (!chunk)
+        {
+            T *fresh = static_cast<T *>(::operator new(sizeof(T) * CHUNK_SIZE));
+            if (chunkSlot.compare_exchange_strong(chunk, fresh, memory_order_acq_rel, memory_order_acquire))
+                chunk = fresh;
+            else
+                ::operator delete(fresh);
+        }
+        return chunk;
+    }
+
+public:
+    ChunkedStore() : pages(new atomic<Page *>[MAX_PAGES]), reserved(0), committed(0)
+    {
+        for (size_t i = 0; i < MAX_PAGES; i++)
+        {
+            pages[i].store(nullptr, memory_order_relaxed);
+        }
+    }
+    ChunkedStore(const ChunkedStore &) = delete;
+    ChunkedStore &operator=(const ChunkedStore &) = delete;
+
+    ~ChunkedStore()
+    {
+        size_t count = committed.load();
+        for (size_t i = 0; i < count; i++)
+        {
+            (*this)[i].~T();
+        }
+        for (size_t i = 0; i < MAX_PAGES; i++)
+        {
+            Page *page = pages[i].load();
+            if (!page)
+                continue;
+            for (size_t c = 0; c < PAGE_SIZE; c++)
+            {
+                ::operator delete(page->chunks[c].load());
+            }
+            delete page;
+        }
+    }
+
+    // T's constructor must not throw: a claimed slot that is never
+    // published would block every later writer for good
+    template <typename... Args>
+    T &emplace_back(Args &&...args)
+    {
+        size_t slot = reserved.fetch_add(1, memory_order_relaxed);
+        T *element = chunkFor(slot) + slot % CHUNK_SIZE;
+        new (element) T(std::forward<Args>(args)...);
+
+        // Wait (yielding) until every earlier slot is published, then publish this one
+        size_t expected = slot;
+        while (!committed.compare_exchange_weak(expected, slot + 1, memory_order_release, memory_order_relaxed))
+        {
+            expected = slot;
+            this_thread::yield();
+        }
+        return *element;
+    }
+
+    T &operator[](size_t i) { return chunkAt(i / CHUNK_SIZE)[i % CHUNK_SIZE]; }
+    const T &operator[](size_t i) const { return chunkAt(i / CHUNK_SIZE)[i % CHUNK_SIZE]; }
+    size_t size() const { return committed.load(memory_order_acquire); }
+};
+
+// Bump arena: hands out 8-byte aligned spans carved from large shared blocks.
+// Lock-free: threads claim space in the current block with fetch_add and
+// race with compare-and-swap to install a fresh block when it runs out.
+class ByteArena
+{
+private:
+    static const size_t BLOCK_SIZE = 256 * 1024;
+
+    struct Block
+    {
+        Block *next; // previously installed block
+        size_t capacity;
+        atomic<size_t> used;
+
+        char *data() { return reinterpret_cast<char *>(this + 1); }
+    };
+    static_assert(sizeof(Block) % 8 == 0, "block data must stay 8-byte aligned");
+
+    atomic<Block *> current;
+    atomic<Block *> oversized; // dedicated blocks for requests too big to share
+
+    static Block *newBlock(size_t capacity, size_t used)
+    {
+        Block *block = static_cast<Block *>(::operator new(sizeof(Block) + capacity));
+        block->next = nullptr;
+        block->capacity = capacity;
+        new (&block->used) atomic<size_t>(used);
+        return block;
+    }
+
+    static void freeChain(Block *block)
+    {
+        while (block)
+        {
+            Block *next = block->next;
+            ::operator delete(block);
+            block = next;
+        }
+    }
+
+public:
+    ByteArena() : current(nullptr), oversized(nullptr) {}
+    ByteArena(const ByteArena &) = delete;
+    ByteArena &operator=(const ByteArena &) = delete;
+
+    ~ByteArena()
+    {
+        freeChain(current.load());
+        freeChain(oversized.load());
+    }
+
+    // The span lives as long as the arena; it is never freed individually
+    char *allocate(size_t bytes)
+    {
+        bytes = (bytes + 7) & ~(size_t)7;
+        if (bytes > BLOCK_SIZE / 4)
+        {
+            Block *block = newBlock(bytes, bytes);
+            block->next = oversized.load(memory_order_relaxed);
+            while (!oversized.compare_exchange_weak(block->next, block, memory_order_release, memory_order_relaxed))
+            {
+            }
+            return block->data();
+        }
+
+        while (true)
+        {
+            Block *block = current.load(memory_order_acquire);
+            if (block)
+            {
+                size_t offset = block->used.fetch_add(bytes, memory_order_relaxed);
+                if (offset + bytes <= block->capacity)
+                    return block->data() + offset;
+            }
+            // Block exhausted (or none yet): install a fresh one already holding this span
+            Block *fresh = newBlock(BLOCK_SIZE, bytes);
+            fresh->next = block;
+            if (current.compare_exchange_strong(block, fresh, memory_order_acq_rel, memory_order_acquire))
+                return fresh->data();
+            ::operator delete(fresh);
+        }
+    }
+};
+
+// One line of an order snapshot; the name is stored in the order's block
+struct OrderLine
+{
+    int productId;
+    int quantity;
+    long long priceCents;
+    unsigned int nameOffset; // into the order's string area
+    unsigned int nameLength;
+};
+
+// Writes a creation time in ctime() format ("Wed Oct 14 17:07:17 2026")
+size_t formatTimestamp(time_t when, char *text, size_t capacity)
+{
+    struct tm local;
+#ifdef _WIN32
+    localtime_s(&local, &when);
+#else
+    localtime_r(&when, &local);
+#endif
+    return strftime(text, capacity, "%a %b %e %H:%M:%S %Y", &local);
+}
+
+// Order class: an immutable snapshot whose lines, product names and payment
+// method all live in one arena block (see OrderStore::add)
+class Order
+{
+private:
+    int orderId;
+    int itemCount;
+    Money totalAmount;
+    time_t createdAt;
+    const OrderLine *lines;
+    const char *strings; // payment method followed by the product names
+    unsigned int methodLength;
+
+public:
+    Order(int id, Money total, time_t created, const OrderLine *orderLines, int count, const char *text,
+          unsigned int methodLen)
+        : orderId(id), itemCount(count), totalAmount(total), createdAt(created), lines(orderLines), strings(text),
+          methodLength(methodLen)
+    {
+    }
+
+    int getOrderId() const { return orderId; }
+    string_view getPaymentMethod() const { return string_view(strings, methodLength); }
+    int getItemCount() const { return itemCount; }
+    const OrderLine &getLine(int i) const { return lines[i]; }
+    string_view getLineName(int i) const { return string_view(strings + lines[i].nameOffset, lines[i].nameLength); }
+    Money getTotalAmount() const { return totalAmount; }
+    time_t getCreatedAt() const { return createdAt; }
+
+    // Order header, line items and total, shared by the screen and log formats
+    void render(TableRenderer &out) const
+    {
+        char date[64];
+        out.text("Order ID: ").number(orderId).text("\n");
+        out.text("Date: ").text(string_view(date, formatTimestamp(createdAt, date, sizeof(date)))).text("\n");
+        out.text("Payment Method: ").text(getPaymentMethod()).text("\n");
+        out.text("Products:\n");
+        out.left("ID", ID_WIDTH + 2).left("Name", NAME_WIDTH).column("Price", PRICE_WIDTH).column("Qty", QTY_WIDTH).text("\n");
+        for (int i = 0; i < itemCount; i++)
+        {
+            out.right(lines[i].productId, ID_WIDTH).text("  ").left(getLineName(i), NAME_WIDTH);
+            out.column(Money::fromCents(lines[i].priceCents), PRICE_WIDTH).column(lines[i].quantity, QTY_WIDTH).text("\n");
+        }
+        out.text("Total Amount: ").money(totalAmount).text("\n");
+    }
+
+    void display() const
+    {
+        TableRenderer &out = TableRenderer::shared();
+        out.text("\n");
+        render(out);
+        out.flushTo(cout);
+    }
+
+    void logToFile(ostream &file) const
+    {
+        TableRenderer &out = TableRenderer::shared();
+        render(out);
+        out.text("---------------------------------\n\n");
+        out.flushTo(file);
+    }
+};
+
+// Order history filter; unset fields match every order
+struct OrderQuery
+{
+    bool hasDateRange;
+    time_t from; // inclusive
+    time_t to;   // inclusive
+    string paymentMethod;
+    size_t offset;
+    size_t limit;
+
+    OrderQuery() : hasDateRange(false), from(0), to(0), offset(0), limit(20) {}
+};
+
+struct OrderPage
+{
+    vector<const Order *> orders; // matches, oldest first
+    size_t totalMatches;
+};
+
+// Order storage: append-only, orders never relocate once stored.
+// Orders are appended without a store-wide lock (see ChunkedStore and
+// ByteArena), though they are published in the order their slots were
+// claimed. The secondary indexes are built lazily: readers catch them up to
+// the published orders under indexLock, so only queries ever wait on it.
+class OrderStore
+{
+private:
+    ChunkedStore<Order> orders;
+    ByteArena snapshots; // one block per order: lines, method and names
+
+    struct MethodPostings
+    {
+        string method;
+        vector<size_t> positions;
+    };
+
+    mutable mutex indexLock;
+    mutable size_t indexed;                  // orders already in the indexes
+    mutable IdIndex byId;                    // order ID -> position
+    struct TimeEntry
+    {
+        time_t created; // copied here so sorting and searching stay in this array
+        size_t position;
+    };
+    static bool createdBefore(const TimeEntry &a, const TimeEntry &b) { return a.created < b.created; }
+
+    mutable vector<TimeEntry> byTime;        // sorted by creation time, stable
+    mutable vector<MethodPostings> byMethod; // a handful of payment methods, searched linearly
+
+    const MethodPostings *postingsFor(string_view method) const
+    {
+        for (size_t i = 0; i < byMethod.size(); i++)
+        {
+            if (byMethod[i].method == method)
+                return &byMethod[i];
+        }
+        return nullptr;
+    }
+
+    void indexOrder(size_t position) const
+    {
+        const Order &order = orders[position];
+        byId.insert(order.getOrderId(), (int)position);
+        MethodPostings *postings = const_cast<MethodPostings *>(postingsFor(order.getPaymentMethod()));
+        if (!postings)
+        {
+            byMethod.push_back(MethodPostings{string(order.getPaymentMethod()), vector<size_t>()});
+            postings = &byMethod.back();
+        }
+        postings->positions.push_back(position);
+        byTime.push_back(TimeEntry{order.getCreatedAt(), position});
+    }
+
+    // Must hold indexLock
+    void catchUpIndexes() const
+    {
+        size_t published = orders.size();
+        size_t sorted = byTime.size();
+        for (; indexed < published; indexed++)
+        {
+            indexOrder(indexed);
+        }
+        // Orders almost always arrive in time order. Otherwise the new entries
+        // are sorted and merged in one pass, touching only the displaced range.
+        vector<TimeEntry>::iterator tail = byTime.begin() + sorted;
+        if (!is_sorted(sorted > 0 ? tail - 1 : tail, byTime.end(), createdBefore))
+        {
+            stable_sort(tail, byTime.end(), createdBefore);
+            inplace_merge(upper_bound(byTime.begin(), tail, *tail, createdBefore), tail, byTime.end(), createdBefore);
+        }
+    }
+
+public:
+    OrderStore() : indexed(0) {}
+
+    // Snapshots the cart lines into a single arena allocation per order.
+    // Safe to call from many threads at once.
+    Order &add(int id, string_view method, const vector<CartItem> &items, Money total, time_t created = time(0))
+    {
+        ScopedTimer timer(Metric::OrderCreate);
+        size_t textBytes = method.size();
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            textBytes += items[i].getProduct().getName().size();
+        }
+        char *block = snapshots.allocate(sizeof(OrderLine) * items.size() + textBytes);
+        OrderLine *lines = reinterpret_cast<OrderLine *>(block);
+        char *text = block + sizeof(OrderLine) * items.size();
+
+        memcpy(text, method.data(), method.size());
+        unsigned int offset = (unsigned int)method.size();
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            const Product &product = items[i].getProduct();
+            const string &name = product.getName();
+            lines[i] = OrderLine{product.getId(), items[i].getQuantity(), product.getPrice().getCents(),
+                                 offset, (unsigned int)name.size()};
+            memcpy(text + offset, name.data(), name.size());
+            offset += (unsigned int)name.size();
+        }
+
+        return orders.emplace_back(id, total, created, lines, (int)items.size(), text, (unsigned int)method.size());
+    }
+
+    size_t size() const { return orders.size(); }
+    const Order &operator[](size_t i) const { return orders[i]; }
+
+    // Returns nullptr if no stored order has this ID
+    const Order *findById(int orderId) const
+    {
+        lock_guard<mutex> guard(indexLock);
+        catchUpIndexes();
+        int position = byId.find(orderId);
+        return position >= 0 ? &orders[position] : nullptr;
+    }
+
+    // A single filter is answered by slicing its candidate list in O(page).
+    // With both, walks the smaller of the date-range and payment-method
+    // candidate sets and checks the other filter on each candidate.
+    OrderPage query(const OrderQuery &q) const
+    {
+        OrderPage page;
+        page.totalMatches = 0;
+        lock_guard<mutex> guard(indexLock);
+        catchUpIndexes();
+
+        size_t timeBegin = 0, timeEnd = byTime.size();
+        if (q.hasDateRange)
+        {
+            timeBegin = lower_bound(byTime.begin(), byTime.end(), TimeEntry{q.from, 0}, createdBefore) - byTime.begin();
+            timeEnd = upper_bound(byTime.begin(), byTime.end(), TimeEntry{q.to, 0}, createdBefore) - byTime.begin();
+            if (timeEnd < timeBegin)
+                timeEnd = timeBegin;
+        }
+
+        const vector<size_t> *methodPositions = nullptr;
+        if (!q.paymentMethod.empty())
+        {
+            const MethodPostings *postings = postingsFor(q.paymentMethod);
+            if (!postings)
+                return page;
+            methodPositions = &postings->positions;
+        }
+
+        // With at most one filter the candidates are exactly the matches, so
+        // the count is known and the page is sliced out directly
+        if (!methodPositions || !q.hasDateRange)
+        {
+            page.totalMatches = methodPositions ? methodPositions->size() : timeEnd - timeBegin;
+            size_t first = min(q.offset, page.totalMatches);
+            size_t last = first + min(q.limit, page.totalMatches - first);
+            for (size_t i = first; i < last; i++)
+            {
+                page.orders.push_back(&orders[methodPositions ? (*methodPositions)[i] : byTime[timeBegin + i].position]);
+            }
+            return page;
+        }
+
+        bool walkMethod = methodPositions->size() < timeEnd - timeBegin;
+        size_t count = walkMethod ? methodPositions->size() : timeEnd - timeBegin;
+        for (size_t i = 0; i < count; i++)
+        {
+            const Order &order = orders[walkMethod ? (*methodPositions)[i] : byTime[timeBegin + i].position];
+            if (walkMethod && (order.getCreatedAt() < q.from || order.getCreatedAt() > q.to))
+                continue;
+            if (!walkMethod && order.getPaymentMethod() != q.paymentMethod)
+                continue;
+            if (page.totalMatches >= q.offset && page.orders.size() < q.limit)
+            {
+                page.orders.push_back(&order);
+            }
+            page.totalMatches++;
+        }
+        return page;
+    }
+};
+
+OrderStore orderStore;
+const string ORDER_LOG_FILE = "order_log.txt";
+
+void initializeOrderLog(bool recovering = false, size_t recoveredOrders = 0)
+{
+    // Clear the log file at startup, unless history was recovered from the journal
+    ofstream outFile(ORDER_LOG_FILE, ios::out | (recovering ? ios::app : ios::trunc));
+    if (outFile.is_open())
+    {
+        if (recovering)
+        {
+            outFile << "Application restarted. Recovered " << recoveredOrders << " orders.\n\n";
+        }
+        else
+        {
+            outFile << "===== ORDER LOG =====\n";
+            outFile << "Application started. Log cleared.\n\n";
+        }
+        outFile.close();
+    }
+    else
+    {
+        cerr << "Warning: Could not open order log file for clearing.\n";
+    }
+}
+
+void logOrderToFile(const Order &order, const string &path = ORDER_LOG_FILE)
+{
+    ScopedTimer timer(Metric::OrderLogWrite);
+    ofstream outFile(path, ios::out | ios::app);
+    if (outFile.is_open())
+    {
+        order.logToFile(outFile);
+        outFile.close();
+    }
+    else
+    {
+        cerr << "Warning: Could not open order log file for writing.\n";
+    }
+}
+
+// Flush policies for the order log writer
+enum FlushPolicy
+{
+    FLUSH_EVERY_ORDER,
+    FLUSH_EVERY_N_ORDERS,
+    FLUSH_INTERVAL
+};
+
+struct OrderLogConfig
+{
+    FlushPolicy policy;
+    int flushEveryN;     // orders per flush for FLUSH_EVERY_N_ORDERS
+    int flushIntervalMs; // maximum buffering time for FLUSH_INTERVAL, checked on write
+    bool syncOnFlush;    // fsync after each flush so logged orders survive a crash
+
+    OrderLogConfig() : policy(FLUSH_EVERY_ORDER), flushEveryN(32), flushIntervalMs(1000), syncOnFlush(false) {}
+};
+
+// Stream buffer that appends into a string whose capacity survives clear()
+class LogBuffer : public streambuf
+{
+private:
+    string data;
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            data.push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    streamsize xsputn(const char *s, streamsize n) override
+    {
+        data.append(s, (size_t)n);
+        return n;
+    }
+
+public:
+    const char *bytes() const { return data.data(); }
+    size_t size() const { return data.size(); }
+    void clear() { data.clear(); }
+};
+
+// Destination for formatted order records, driven by AsyncOrderLogger
+class OrderLogSink
+{
+public:
+    virtual ~OrderLogSink() {}
+    virtual void append(const Order &order) = 0;
+    // Called after every batch and periodically while idle
+    virtual void flushIfDue() = 0;
+    virtual void flush() = 0;
+};
+
+// Long-lived, buffered writer for the order log (opened once per process)
+class OrderLogWriter : public OrderLogSink
+{
+private:
+    FILE *file;
+    OrderLogConfig config;
+    LogBuffer buffer;
+    ostream out;
+    int pendingOrders;
+    unsigned long long flushedBytes;
+    chrono::steady_clock::time_point lastFlush;
+
+    bool shouldFlush() const
+    {
+        switch (config.policy)
+        {
+        case FLUSH_EVERY_N_ORDERS:
+            return pendingOrders >= config.flushEveryN;
+        case FLUSH_INTERVAL:
+            return chrono::steady_clock::now() - lastFlush >= chrono::milliseconds(config.flushIntervalMs);
+        default:
+            return true;
+        }
+    }
+
+    static void syncToDisk(FILE *f)
+    {
+#ifdef _WIN32
+        _commit(_fileno(f));
+#else
+        fsync(fileno(f));
+#endif
+    }
+
+public:
+    OrderLogWriter(const string &path, const OrderLogConfig &cfg = OrderLogConfig())
+        : file(fopen(path.c_str(), "ab")), config(cfg), out(&buffer), pendingOrders(0), flushedBytes(0),
+          lastFlush(chrono::steady_clock::now())
+    {
+        if (!file)
+        {
+            cerr << "Warning: Could not open order log file for writing.\n";
+        }
+    }
+
+    OrderLogWriter(const OrderLogWriter &) = delete;
+    OrderLogWriter &operator=(const OrderLogWriter &) = delete;
+
+    ~OrderLogWriter() override
+    {
+        flush();
+        if (file)
+        {
+            fclose(file);
+        }
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    void write(const Order &order)
+    {
+        append(order);
+        flushIfDue();
+    }
+
+    // Formats an order into the buffer without considering the flush policy
+    void append(const Order &order) override
+    {
+        if (!file)
+            return;
+        ScopedTimer timer(Metric::OrderLogWrite);
+        order.logToFile(out);
+        pendingOrders++;
+    }
+
+    void flushIfDue() override
+    {
+        if (pendingOrders > 0 && shouldFlush())
+        {
+            flush();
+        }
+    }
+
+    // Bytes written by this writer, including any still buffered
+    unsigned long long bytesWritten() const { return flushedBytes + buffer.size(); }
+
+    // Hands buffered orders to the OS, and to the disk if syncOnFlush is set
+    void flush() override
+    {
+        if (file && buffer.size() > 0)
+        {
+            fwrite(buffer.bytes(), 1, buffer.size(), file);
+            flushedBytes += buffer.size();
+            fflush(file);
+            if (config.syncOnFlush)
+            {
+                syncToDisk(file);
+            }
+        }
+        buffer.clear();
+        pendingOrders = 0;
+        lastFlush = chrono::steady_clock::now();
+    }
+};
+
+// CRC-32 (IEEE 802.3) used to detect torn or damaged journal records
+unsigned int crc32(const void *data, size_t length)
+{
+    static const vector<unsigned int> table = []
+    {
+        vector<unsigned int> t(256);
+        for (unsigned int i = 0; i < 256; i++)
+        {
+            unsigned int c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    unsigned int crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Binary order journal layout (native little-endian):
+//   file header:  8-byte magic "ORDJRNL2", u64 journal ID (random per journal;
+//                 "ORDJRNL1" files have no ID and count as journal 0)
+//   each record:  u32 payload length, u32 CRC-32 of payload, payload
+//   payload:      i32 order ID, i64 created-at epoch, i64 total cents,
+//                 u16 method length + bytes, u32 line count, then per line:
+//                 i32 product ID, i32 quantity, i64 price cents, u16 name length + bytes
+const char JOURNAL_MAGIC[8] = {'O', 'R', 'D', 'J', 'R', 'N', 'L', '2'};
+const char JOURNAL_MAGIC_V1[8] = {'O', 'R', 'D', 'J', 'R', 'N', 'L', '1'};
+
+// Parses the journal header; headerSize is where the first record starts
+bool parseJournalHeader(const char *data, size_t size, unsigned long long &journalId, size_t &headerSize)
+{
+    if (size >= sizeof(JOURNAL_MAGIC) + sizeof(journalId) && memcmp(data, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0)
+    {
+        memcpy(&journalId, data + sizeof(JOURNAL_MAGIC), sizeof(journalId));
+        headerSize = sizeof(JOURNAL_MAGIC) + sizeof(journalId);
+        return true;
+    }
+    if (size >= sizeof(JOURNAL_MAGIC_V1) && memcmp(data, JOURNAL_MAGIC_V1, sizeof(JOURNAL_MAGIC_V1)) == 0)
+    {
+        journalId = 0;
+        headerSize = sizeof(JOURNAL_MAGIC_V1);
+        return true;
+    }
+    return false;
+}
+const string ORDER_JOURNAL_FILE = "order_journal.bin";
+
+const string ORDER_CHECKPOINT_FILE = "order_journal.ckpt";
+const size_t RECOVERY_RETAIN_ORDERS = 10000; // most recent orders reloaded on restart
+const size_t CHECKPOINT_EVERY_ORDERS = 1000;
+
+// Restart checkpoint: where replay starts and which order ID comes next. It
+// is only trusted for the journal whose ID it carries.
+struct JournalCheckpoint
+{
+    unsigned long long journalId;
+    unsigned long long replayOffset;  // first record of the retained window
+    unsigned long long journalLength; // journal bytes covered by this checkpoint
+    int nextOrderId;
+};
+
+const char CHECKPOINT_MAGIC[8] = {'O', 'R', 'D', 'C', 'K', 'P', 'T', '2'};
+
+// Replaces the checkpoint atomically by writing a temporary file and renaming it
+bool writeJournalCheckpoint(const string &path, const JournalCheckpoint &checkpoint)
+{
+    string tmpPath = path + ".tmp";
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    if (!f)
+        return false;
+    unsigned int checksum = crc32(&checkpoint, sizeof(checkpoint));
+    bool ok = fwrite(CHECKPOINT_MAGIC, 1, sizeof(CHECKPOINT_MAGIC), f) == sizeof(CHECKPOINT_MAGIC) &&
+              fwrite(&checkpoint, sizeof(checkpoint), 1, f) == 1 &&
+              fwrite(&checksum, sizeof(checksum), 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+    error_code ec;
+    if (ok)
+    {
+        filesystem::rename(tmpPath, path, ec);
+    }
+    return ok && !ec;
+}
+
+bool readJournalCheckpoint(const string &path, JournalCheckpoint &checkpoint)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    unsigned int checksum = 0;
+    bool ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+              memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0 &&
+              fread(&checkpoint, sizeof(checkpoint), 1, f) == 1 &&
+              fread(&checksum, sizeof(checksum), 1, f) == 1 &&
+              crc32(&checkpoint, sizeof(checkpoint)) == checksum;
+    fclose(f);
+    return ok;
+}
+
+// Append-only writer for the binary order journal
+class OrderJournalWriter
+{
+private:
+    FILE *file;
+    bool syncOnFlush;
+    string record;                // reused encoding buffer
+    unsigned long long position;  // journal offset of the next record
+    unsigned long long journalId;
+    bool startedNew;              // this writer created the journal file
+
+    // Checkpointing, enabled by enableCheckpoints()
+    string checkpointPath;
+    size_t retainOrders;
+    size_t checkpointEvery;
+    size_t sinceCheckpoint;
+    int nextOrderId;
+    deque<unsigned long long> retainedOffsets; // offsets of the newest retainOrders records
+
+    void writeCheckpoint()
+    {
+        flush(); // the checkpoint must never cover bytes still in a buffer
+        JournalCheckpoint checkpoint = {}; // the CRC covers padding bytes too
+        checkpoint.journalId = journalId;
+        checkpoint.replayOffset = retainedOffsets.empty() ? position : retainedOffsets.front();
+        checkpoint.journalLength = position;
+        checkpoint.nextOrderId = nextOrderId;
+        if (!writeJournalCheckpoint(checkpointPath, checkpoint))
+        {
+            cerr << "Warning: Could not write order journal checkpoint.\n";
+        }
+        sinceCheckpoint = 0;
+    }
+
+    template <typename T>
+    void put(T value) { record.append(reinterpret_cast<const char *>(&value), sizeof(T)); }
+
+    void putString(string_view text)
+    {
+        put<unsigned short>((unsigned short)text.size());
+        record.append(text.data(), text.size());
+    }
+
+public:
+    // truncate starts a new journal; otherwise records are appended to it
+    OrderJournalWriter(const string &path, bool truncate, bool sync = false)
+        : file(fopen(path.c_str(), truncate ? "wb" : "ab")), syncOnFlush(sync), position(0),
+          journalId(0), startedNew(false), retainOrders(0), checkpointEvery(0), sinceCheckpoint(0), nextOrderId(1)
+    {
+        if (!file)
+        {
+            cerr << "Warning: Could not open order journal for writing.\n";
+            return;
+        }
+        fseek(file, 0, SEEK_END);
+        if (ftell(file) == 0)
+        {
+            // A fresh ID so checkpoints left over from an earlier journal never match
+            random_device entropy;
+            mt19937_64 rng(((unsigned long long)entropy() << 32) ^ entropy() ^
+                           (unsigned long long)chrono::steady_clock::now().time_since_epoch().count());
+            while (journalId == 0)
+            {
+                journalId = rng();
+            }
+            fwrite(JOURNAL_MAGIC, 1, sizeof(JOURNAL_MAGIC), file);
+            fwrite(&journalId, sizeof(journalId), 1, file);
+            startedNew = true;
+        }
+        else
+        {
+            char header[sizeof(JOURNAL_MAGIC) + sizeof(journalId)] = {};
+            size_t headerSize;
+            FILE *existing = fopen(path.c_str(), "rb");
+            size_t got = existing ? fread(header, 1, sizeof(header), existing) : 0;
+            if (existing)
+                fclose(existing);
+            if (!parseJournalHeader(header, got, journalId, headerSize))
+            {
+                cerr << "Warning: " << path << " is not an order journal; appending anyway.\n";
+            }
+        }
+        position = (unsigned long long)ftell(file);
+    }
+
+    // Periodically records a checkpoint so restart replays a bounded window.
+    // recoveredOffsets are the journal offsets of orders already replayed.
+    void enableCheckpoints(const string &path, size_t retain, size_t every, int firstOrderId,
+                           const vector<unsigned long long> &recoveredOffsets)
+    {
+        checkpointPath = path;
+        if (startedNew)
+        {
+            error_code ec;
+            filesystem::remove(path, ec); // describes a journal that no longer exists
+        }
+        retainOrders = retain;
+        checkpointEvery = every;
+        nextOrderId = firstOrderId;
+        retainedOffsets.assign(recoveredOffsets.begin(), recoveredOffsets.end());
+        while (retainedOffsets.size() > retainOrders)
+        {
+            retainedOffsets.pop_front();
+        }
+    }
+
+    OrderJournalWriter(const OrderJournalWriter &) = delete;
+    OrderJournalWriter &operator=(const OrderJournalWriter &) = delete;
+
+    ~OrderJournalWriter()
+    {
+        if (file)
+        {
+            if (!checkpointPath.empty())
+            {
+                writeCheckpoint();
+            }
+            flush();
+            fclose(file);
+        }
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    void append(const Order &order)
+    {
+        if (!file)
+            return;
+        ScopedTimer timer(Metric::JournalWrite);
+        record.assign(8, '\0'); // length and CRC are patched in below
+        put<int>(order.getOrderId());
+        put<long long>((long long)order.getCreatedAt());
+        put<long long>(order.getTotalAmount().getCents());
+        putString(order.getPaymentMethod());
+        put<unsigned int>((unsigned int)order.getItemCount());
+        for (int i = 0; i < order.getItemCount(); i++)
+        {
+            const OrderLine &line = order.getLine(i);
+            put<int>(line.productId);
+            put<int>(line.quantity);
+            put<long long>(line.priceCents);
+            putString(order.getLineName(i));
+        }
+        unsigned int length = (unsigned int)(record.size() - 8);
+        unsigned int checksum = crc32(record.data() + 8, length);
+        memcpy(&record[0], &length, 4);
+        memcpy(&record[4], &checksum, 4);
+        fwrite(record.data(), 1, record.size(), file);
+
+        if (!checkpointPath.empty())
+        {
+            retainedOffsets.push_back(position);
+            if (retainedOffsets.size() > retainOrders)
+            {
+                retainedOffsets.pop_front();
+            }
+            if (order.getOrderId() >= nextOrderId)
+            {
+                nextOrderId = order.getOrderId() + 1;
+            }
+        }
+        position += record.size();
+        if (!checkpointPath.empty() && ++sinceCheckpoint >= checkpointEvery)
+        {
+            writeCheckpoint();
+        }
+    }
+
+    void flush()
+    {
+        if (!file)
+            return;
+        fflush(file);
+        if (syncOnFlush)
+        {
+#ifdef _WIN32
+            _commit(_fileno(file));
+#else
+            fsync(fileno(file));
+#endif
+        }
+    }
+};
+
+// One journal line item, decoded in place from the mapping
+struct JournalLine
+{
+    int productId;
+    int quantity;
+    long long priceCents;
+    string_view name;
+};
+
+// One journal order; strings point into the mapping, lines are decoded on demand
+struct JournalOrder
+{
+    int orderId;
+    long long createdAt;
+    long long totalCents;
+    string_view paymentMethod;
+    unsigned int itemCount;
+    const char *lines;    // encoded line items
+    const char *linesEnd; // end of this record's payload
+};
+
+// Iterates a memory-mapped order journal without any text parsing. A damaged
+// record is skipped by scanning ahead to the next intact one, so corruption in
+// the middle of the file never hides the orders written after it.
+class OrderJournalReader
+{
+private:
+    MappedFile map;
+    size_t offset;
+    size_t lastRecord;   // offset of the record most recently returned by next()
+    size_t skipped;      // damaged bytes passed over so far
+    size_t tornTail;     // offset of an incomplete final record, or 0 if none
+    size_t headerSize;
+    unsigned long long id;
+
+    template <typename T>
+    static bool get(const char *&cursor, const char *end, T &value)
+    {
+        if ((size_t)(end - cursor) < sizeof(T))
+            return false;
+        memcpy(&value, cursor, sizeof(T));
+        cursor += sizeof(T);
+        return true;
+    }
+
+    static bool getString(const char *&cursor, const char *end, string_view &text)
+    {
+        unsigned short length;
+        if (!get(cursor, end, length) || (size_t)(end - cursor) < length)
+            return false;
+        text = string_view(cursor, length);
+        cursor += length;
+        return true;
+    }
+
+    // Decodes the record at position if it is complete and intact. The cheap
+    // structural checks run before the CRC so that resyncing stays fast.
+    bool decodeAt(size_t position, JournalOrder &order) const
+    {
+        const char *end = map.data() + map.size();
+        const char *cursor = map.data() + position;
+        unsigned int length, checksum;
+        if (!get(cursor, end, length) || !get(cursor, end, checksum) || (size_t)(end - cursor) < length)
+            return false;
+        const char *payload = cursor;
+        const char *payloadEnd = cursor + length;
+        if (!get(cursor, payloadEnd, order.orderId) ||
+            !get(cursor, payloadEnd, order.createdAt) ||
+            !get(cursor, payloadEnd, order.totalCents) ||
+            !getString(cursor, payloadEnd, order.paymentMethod) ||
+            !get(cursor, payloadEnd, order.itemCount))
+            return false;
+        order.lines = cursor;
+        order.linesEnd = payloadEnd;
+        JournalLine line;
+        for (unsigned int i = 0; i < order.itemCount; i++)
+        {
+            if (!readLine(cursor, payloadEnd, line))
+                return false;
+        }
+        return cursor == payloadEnd && crc32(payload, length) == checksum;
+    }
+
+    // True when the record at position runs past the physical end of the file
+    bool incompleteAt(size_t position) const
+    {
+        const char *end = map.data() + map.size();
+        const char *cursor = map.data() + position;
+        unsigned int length, checksum;
+        return !get(cursor, end, length) || !get(cursor, end, checksum) || (size_t)(end - cursor) < length;
+    }
+
+public:
+    OrderJournalReader() : offset(0), lastRecord(0), skipped(0), tornTail(0), headerSize(0), id(0) {}
+
+    // Fails if the file is missing or is not an order journal
+    bool open(const string &path)
+    {
+        offset = 0;
+        skipped = 0;
+        tornTail = 0;
+        if (!map.open(path) || !parseJournalHeader(map.data(), map.size(), id, headerSize))
+        {
+            map.close();
+            return false;
+        }
+        map.adviseSequential();
+        offset = headerSize;
+        return true;
+    }
+
+    // Continues reading at a record boundary previously seen via recordOffset();
+    // fails unless an intact record (or the end of the file) is found there
+    bool seek(size_t position)
+    {
+        JournalOrder order;
+        if (position < headerSize || position > map.size() ||
+            (position < map.size() && !decodeAt(position, order)))
+            return false;
+        offset = position;
+        skipped = 0;
+        tornTail = 0;
+        return true;
+    }
+
+    // Decodes the next intact record, resyncing past any damaged bytes
+    bool next(JournalOrder &order)
+    {
+        if (offset >= map.size())
+            return false;
+        if (!decodeAt(offset, order))
+        {
+            size_t resume = offset + 1;
+            while (resume < map.size() && !decodeAt(resume, order))
+            {
+                resume++;
+            }
+            if (resume >= map.size())
+            {
+                // Nothing intact follows. Only a record cut short by the end of
+                // the file is a torn write; anything else is left in place.
+                if (incompleteAt(offset))
+                    tornTail = offset;
+                else
+                    skipped += map.size() - offset;
+                offset = map.size();
+                return false;
+            }
+            skipped += resume - offset;
+            offset = resume;
+        }
+        lastRecord = offset;
+        offset = order.linesEnd - map.data();
+        return true;
+    }
+
+    // Decodes the line at cursor and advances it; start with cursor = order.lines
+    static bool readLine(const char *&cursor, const char *end, JournalLine &line)
+    {
+        return get(cursor, end, line.productId) && get(cursor, end, line.quantity) &&
+               get(cursor, end, line.priceCents) && getString(cursor, end, line.name);
+    }
+
+    size_t recordOffset() const { return lastRecord; }
+    size_t fileSize() const { return map.size(); }
+    unsigned long long journalId() const { return id; }
+    size_t skippedBytes() const { return skipped; }
+    // Offset of a torn final record that may be cut off, or 0 if there is none
+    size_t tornTailOffset() const { return tornTail; }
+};
+
+struct RecoveryResult
+{
+    size_t ordersRecovered;
+    int nextOrderId;
+    bool usedCheckpoint;
+    bool truncatedTail;                       // a torn final record was cut off
+    size_t skippedBytes;                      // damaged bytes left in place and skipped
+    vector<unsigned long long> recordOffsets; // journal offsets of the recovered orders
+};
+
+// Rebuilds the order store from the journal. With a valid checkpoint only the
+// retained window and the orders written after it are replayed, so restart
+// time does not grow with the length of the history.
+RecoveryResult recoverOrders(OrderStore &store, const string &journalPath, const string &checkpointPath)
+{
+    RecoveryResult result = {0, 1, false, false, 0, vector<unsigned long long>()};
+    size_t tornTail = 0;
+    {
+        OrderJournalReader reader;
+        if (!reader.open(journalPath))
+            return result;
+
+        JournalCheckpoint checkpoint;
+        if (readJournalCheckpoint(checkpointPath, checkpoint) && checkpoint.journalId == reader.journalId() &&
+            checkpoint.journalLength <= reader.fileSize() && reader.seek((size_t)checkpoint.replayOffset))
+        {
+            result.usedCheckpoint = true;
+            result.nextOrderId = checkpoint.nextOrderId;
+        }
+
+        JournalOrder order;
+        vector<CartItem> items;
+        while (reader.next(order))
+        {
+            items.clear();
+            const char *cursor = order.lines;
+            JournalLine line;
+            while (OrderJournalReader::readLine(cursor, order.linesEnd, line))
+            {
+                items.emplace_back(Product(line.productId, string(line.name), Money::fromCents(line.priceCents)), line.quantity);
+            }
+            store.add(order.orderId, order.paymentMethod, items, Money::fromCents(order.totalCents),
+                      (time_t)order.createdAt);
+            result.recordOffsets.push_back(reader.recordOffset());
+            result.ordersRecovered++;
+            if (order.orderId >= result.nextOrderId)
+            {
+                result.nextOrderId = order.orderId + 1;
+            }
+        }
+        result.skippedBytes = reader.skippedBytes();
+        tornTail = reader.tornTailOffset();
+    }
+
+    // Cut off a torn tail so new records are appended directly after intact
+    // ones. Damage before the last intact record is never truncated.
+    if (tornTail != 0)
+    {
+        error_code ec;
+        filesystem::resize_file(journalPath, tornTail, ec);
+        result.truncatedTail = !ec;
+    }
+    return result;
+}
+
+// Bounded lock-free queue: many producers, one consumer (Vyukov sequence cells)
+template <typename T>
+class MpscRing
+{
+private:
+    struct Cell
+    {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) atomic<size_t> enqueuePos;
+    alignas(64) size_t dequeuePos; // only touched by the consumer
+
+public:
+    // capacity is rounded up to a power of two
+    explicit MpscRing(size_t capacity) : enqueuePos(0), dequeuePos(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+        {
+            cells[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    // Returns false instead of waiting when the ring is full
+    bool tryPush(const T &value)
+    {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        Cell *cell;
+        while (true)
+        {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(memory_order_acquire);
+            long long diff = (long long)seq - (long long)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T &value)
+    {
+        Cell *cell = &cells[dequeuePos & mask];
+        size_t seq = cell->sequence.load(memory_order_acquire);
+        if ((long long)seq - (long long)(dequeuePos + 1) < 0)
+            return false;
+        value = cell->value;
+        cell->sequence.store(dequeuePos + mask + 1, memory_order_release);
+        dequeuePos++;
+        return true;
+    }
+};
+
+// What submit() does when the logging ring is full
+enum BackpressurePolicy
+{
+    BACKPRESSURE_BLOCK, // spin until the writer thread frees a slot
+    BACKPRESSURE_DROP   // skip the record and count it as dropped
+};
+
+// Background order logging: checkout enqueues, one writer thread per sink formats and writes
+class AsyncOrderLogger
+{
+private:
+    static const int MAX_BATCH = 256;
+
+    // One ring and writer thread per sink, so writers never share a file
+    struct Shard
+    {
+        OrderLogSink *sink;
+        MpscRing<const Order *> ring; // orders are immutable and never move in OrderStore
+        thread worker;
+
+        Shard(OrderLogSink *s, size_t capacity) : sink(s), ring(capacity) {}
+    };
+
+    vector<unique_ptr<Shard>> shards;
+    OrderJournalWriter *journal; // optional binary journal next to the text log
+    mutex journalLock;           // the journal is shared by every shard
+    BackpressurePolicy backpressure;
+    atomic<bool> closed;      // shutdown() started; submit() refuses new records
+    atomic<int> submitting;   // submit() calls that got past the closed check
+    atomic<bool> stopping;    // tells the writer threads to drain and exit
+    atomic<unsigned long long> dropped;
+
+    int drainBatch(Shard &shard)
+    {
+        const Order *order;
+        int written = 0;
+        while (written < MAX_BATCH && shard.ring.tryPop(order))
+        {
+            shard.sink->append(*order);
+            if (journal)
+            {
+                lock_guard<mutex> guard(journalLock);
+                journal->append(*order);
+            }
+            written++;
+        }
+        return written;
+    }
+
+    void flushJournal()
+    {
+        if (journal)
+        {
+            lock_guard<mutex> guard(journalLock);
+            journal->flush();
+        }
+    }
+
+    void run(Shard *shard)
+    {
+        while (!stopping.load())
+        {
+            if (drainBatch(*shard) > 0)
+            {
+                shard->sink->flushIfDue();
+                flushJournal();
+            }
+            else
+            {
+                shard->sink->flushIfDue();
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        }
+        // Drain-on-shutdown: everything submitted before shutdown() is written
+        while (drainBatch(*shard) > 0)
+        {
+        }
+        shard->sink->flush();
+        flushJournal();
+    }
+
+    void start(const vector<OrderLogSink *> &sinks, size_t capacity)
+    {
+        for (size_t i = 0; i < sinks.size(); i++)
+        {
+            shards.push_back(unique_ptr<Shard>(new Shard(sinks[i], capacity)));
+        }
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            shards[i]->worker = thread(&AsyncOrderLogger::run, this, shards[i].get());
+        }
+    }
+
+public:
+    AsyncOrderLogger(OrderLogSink &w, OrderJournalWriter *j = nullptr, size_t capacity = 4096,
+                     BackpressurePolicy policy = BACKPRESSURE_BLOCK)
+        : journal(j), backpressure(policy), closed(false), submitting(0), stopping(false), dropped(0)
+    {
+        start(vector<OrderLogSink *>(1, &w), capacity);
+    }
+
+    // Sharded: each submitting thread always feeds the same sink
+    AsyncOrderLogger(const vector<OrderLogSink *> &sinks, OrderJournalWriter *j = nullptr, size_t capacity = 4096,
+                     BackpressurePolicy policy = BACKPRESSURE_BLOCK)
+        : journal(j), backpressure(policy), closed(false), submitting(0), stopping(false), dropped(0)
+    {
+        start(sinks, capacity);
+    }
+
+    AsyncOrderLogger(const AsyncOrderLogger &) = delete;
+    AsyncOrderLogger &operator=(const AsyncOrderLogger &) = delete;
+
+    ~AsyncOrderLogger() { shutdown(); }
+
+    // Safe to call from any thread; returns false if the record was dropped,
+    // which includes every record submitted after shutdown() has started
+    bool submit(const Order &order)
+    {
+        static atomic<unsigned int> nextShard(0);
+        thread_local unsigned int home = nextShard.fetch_add(1, memory_order_relaxed);
+        submitting.fetch_add(1);
+        if (closed.load())
+        {
+            submitting.fetch_sub(1);
+            dropped.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        // The writers keep running until every admitted submit has finished, so
+        // a blocked push always completes
+        MpscRing<const Order *> &ring = shards[home % shards.size()]->ring;
+        while (!ring.tryPush(&order))
+        {
+            if (backpressure == BACKPRESSURE_DROP)
+            {
+                submitting.fetch_sub(1);
+                dropped.fetch_add(1, memory_order_relaxed);
+                return false;
+            }
+            this_thread::yield();
+        }
+        submitting.fetch_sub(1);
+        return true;
+    }
+
+    // Writes every record submitted before the call, flushes and stops the
+    // writer threads
+    void shutdown()
+    {
+        closed.store(true);
+        while (submitting.load() != 0)
+        {
+            this_thread::yield();
+        }
+        stopping.store(true);
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            if (shards[i]->worker.joinable())
+            {
+                shards[i]->worker.join();
+            }
+        }
+    }
+
+    unsigned long long droppedCount() const { return dropped.load(memory_order_relaxed); }
+};
+
+// LZ4 block format codec for closed log segments: each sequence is a token
+// (literal length, match length - 4), the literals and a 16-bit back offset
+const int LZ4_MIN_MATCH = 4;
+const int LZ4_HASH_LOG = 12;
+const size_t LZ4_LAST_LITERALS = 5; // the block always ends in literals
+const size_t LZ4_MATCH_GUARD = 12;  // the last match starts this far before the end
+
+size_t lz4CompressBound(size_t length) { return length + length / 255 + 16; }
+
+static void lz4PutLength(unsigned char *&op, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        *op++ = 255;
+    }
+    *op++ = (unsigned char)length;
+}
+
+// dst needs lz4CompressBound(length) bytes; returns the compressed size
+size_t lz4Compress(const unsigned char *src, size_t length, unsigned char *dst)
+{
+    unsigned int table[1 << LZ4_HASH_LOG] = {}; // position + 1, 0 if empty
+    unsigned char *op = dst;
+    size_t anchor = 0;
+    size_t ip = 0;
+    while (length >= LZ4_MATCH_GUARD + 1 && ip + LZ4_MATCH_GUARD <= length)
+    {
+        unsigned int sequence;
+        memcpy(&sequence, src + ip, sizeof(sequence));
+        unsigned int slot = (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+        size_t candidate = table[slot];
+        table[slot] = (unsigned int)ip + 1;
+        if (candidate == 0 || ip - (candidate - 1) > 65535 || memcmp(src + candidate - 1, src + ip, LZ4_MIN_MATCH) != 0)
+        {
+            ip++;
+            continue;
+        }
+        size_t match = candidate - 1;
+        size_t matchLength = LZ4_MIN_MATCH;
+        while (ip + matchLength < length - LZ4_LAST_LITERALS && src[match + matchLength] == src[ip + matchLength])
+        {
+            matchLength++;
+        }
+
+        size_t literals = ip - anchor;
+        size_t extra = matchLength - LZ4_MIN_MATCH;
+        *op++ = (unsigned char)((min(literals, (size_t)15) << 4) | min(extra, (size_t)15));
+        if (literals >= 15)
+            lz4PutLength(op, literals - 15);
+        memcpy(op, src + anchor, literals);
+        op += literals;
+        size_t offset = ip - match;
+        *op++ = (unsigned char)(offset & 0xFF);
+        *op++ = (unsigned char)(offset >> 8);
+        if (extra >= 15)
+            lz4PutLength(op, extra - 15);
+
+        ip += matchLength;
+        anchor = ip;
+    }
+
+    size_t literals = length - anchor;
+    *op++ = (unsigned char)(min(literals, (size_t)15) << 4);
+    if (literals >= 15)
+        lz4PutLength(op, literals - 15);
+    memcpy(op, src + anchor, literals);
+    op += literals;
+    return (size_t)(op - dst);
+}
+
+// Returns false on malformed input or if the output is not exactly rawLength bytes
+bool lz4Decompress(const unsigned char *src, size_t length, unsigned char *dst, size_t rawLength)
+{
+    const unsigned char *ip = src;
+    const unsigned char *end = src + length;
+    size_t op = 0;
+    while (ip < end)
+    {
+        unsigned int token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15)
+        {
+            unsigned char more;
+            do
+            {
+                if (ip == end)
+                    return false;
+                more = *ip++;
+                literals += more;
+            } while (more == 255);
+        }
+        if ((size_t)(end - ip) < literals || rawLength - op < literals)
+            return false;
+        memcpy(dst + op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return false;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return false;
+        size_t matchLength = token & 15;
+        if (matchLength == 15)
+        {
+            unsigned char more;
+            do
+            {
+                if (ip == end)
+                    return false;
+                more = *ip++;
+                matchLength += more;
+            } while (more == 255);
+        }
+        matchLength += LZ4_MIN_MATCH;
+        if (rawLength - op < matchLength)
+            return false;
+        // Byte by byte: the match may overlap the bytes it produces
+        for (size_t i = 0; i < matchLength; i++, op++)
+        {
+            dst[op] = dst[op - offset];
+        }
+    }
+    return op == rawLength;
+}
+
+// Compressed segment: magic, then 64 KB blocks of (raw length, stored length,
+// data); the top bit of the stored length marks a block kept uncompressed
+const char SEGMENT_MAGIC[8] = {'O', 'L', 'O', 'G', 'L', 'Z', '4', '1'};
+const size_t SEGMENT_BLOCK_SIZE = 64 * 1024;
+const unsigned int SEGMENT_BLOCK_STORED = 0x80000000u;
+
+bool readWholeFile(const string &path, string &data)
+{
+    ifstream in(path, ios::in | ios::binary);
+    if (!in.is_open())
+        return false;
+    data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    return !in.bad();
+}
+
+// Reads a segment's text, decompressing it if needed
+bool readSegmentText(const string &path, bool compressed, string &text)
+{
+    if (!compressed)
+        return readWholeFile(path, text);
+    string data;
+    if (!readWholeFile(path, data) || data.size() < sizeof(SEGMENT_MAGIC) ||
+        memcmp(data.data(), SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0)
+        return false;
+    text.clear();
+    size_t at = sizeof(SEGMENT_MAGIC);
+    while (at < data.size())
+    {
+        unsigned int header[2];
+        if (data.size() - at < sizeof(header))
+            return false;
+        memcpy(header, data.data() + at, sizeof(header));
+        at += sizeof(header);
+        unsigned int storedLength = header[1] & ~SEGMENT_BLOCK_STORED;
+        if (header[0] > SEGMENT_BLOCK_SIZE || data.size() - at < storedLength)
+            return false;
+        const unsigned char *src = (const unsigned char *)data.data() + at;
+        size_t start = text.size();
+        text.resize(start + header[0]);
+        if (header[1] & SEGMENT_BLOCK_STORED)
+        {
+            if (storedLength != header[0])
+                return false;
+            memcpy(&text[start], src, storedLength);
+        }
+        else if (!lz4Decompress(src, storedLength, (unsigned char *)&text[start], header[0]))
+        {
+            return false;
+        }
+        at += storedLength;
+    }
+    return true;
+}
+
+// Writes the compressed copy next to rawPath; returns the compressed size, 0 on failure
+unsigned long long compressSegmentFile(const string &rawPath, const string &compressedPath)
+{
+    string raw;
+    if (!readWholeFile(rawPath, raw))
+        return 0;
+    string tmpPath = compressedPath + ".tmp";
+    FILE *f = fopen(tmpPath.c_str(), "wb");
+    if (!f)
+        return 0;
+    vector<unsigned char> block(lz4CompressBound(SEGMENT_BLOCK_SIZE));
+    unsigned long long stored = sizeof(SEGMENT_MAGIC);
+    bool ok = fwrite(SEGMENT_MAGIC, 1, sizeof(SEGMENT_MAGIC), f) == sizeof(SEGMENT_MAGIC);
+    for (size_t at = 0; ok && at < raw.size(); at += SEGMENT_BLOCK_SIZE)
+    {
+        unsigned int rawLength = (unsigned int)min(SEGMENT_BLOCK_SIZE, raw.size() - at);
+        const unsigned char *src = (const unsigned char *)raw.data() + at;
+        unsigned int storedLength = (unsigned int)lz4Compress(src, rawLength, block.data());
+        unsigned int header[2] = {rawLength, storedLength};
+        if (storedLength >= rawLength)
+        {
+            header[1] = rawLength | SEGMENT_BLOCK_STORED;
+            storedLength = rawLength;
+        }
+        else
+        {
+            src = block.data();
+        }
+        ok = fwrite(header, sizeof(header), 1, f) == 1 && fwrite(src, 1, storedLength, f) == storedLength;
+        stored += sizeof(header) + storedLength;
+    }
+    ok = fclose(f) == 0 && ok;
+    // Read the copy back before it replaces the raw segment, which is deleted next
+    string check;
+    ok = ok && readSegmentText(tmpPath, true, check) && check == raw;
+    error_code ec;
+    if (ok)
+    {
+        filesystem::rename(tmpPath, compressedPath, ec);
+    }
+    else
+    {
+        filesystem::remove(tmpPath, ec);
+    }
+    return ok && !ec ? stored : 0;
+}
+
+// One closed log segment: which orders it holds and where it lives
+struct SegmentInfo
+{
+    unsigned long long sequence;
+    size_t shard;
+    int firstOrderId;
+    int lastOrderId;
+    size_t orders;
+    unsigned long long rawBytes;
+    unsigned long long storedBytes;
+    bool compressed;
+    string file; // relative to the log directory
+};
+
+// Order ID ranges of every closed segment, kept as a small text file
+class SegmentIndex
+{
+private:
+    vector<SegmentInfo> segments; // by sequence
+
+public:
+    bool load(const string &path)
+    {
+        segments.clear();
+        ifstream in(path);
+        if (!in.is_open())
+            return false;
+        string line;
+        while (getline(in, line))
+        {
+            istringstream fields(line);
+            SegmentInfo info;
+            if (fields >> info.sequence >> info.shard >> info.firstOrderId >> info.lastOrderId >> info.orders >>
+                info.rawBytes >> info.storedBytes >> info.compressed >> info.file)
+            {
+                add(info);
+            }
+        }
+        return true;
+    }
+
+    // Replaces the index atomically by writing a temporary file and renaming it
+    bool save(const string &path) const
+    {
+        string tmpPath = path + ".tmp";
+        {
+            ofstream out(tmpPath, ios::out | ios::trunc);
+            for (size_t i = 0; i < segments.size(); i++)
+            {
+                const SegmentInfo &info = segments[i];
+                out << info.sequence << ' ' << info.shard << ' ' << info.firstOrderId << ' ' << info.lastOrderId << ' '
+                    << info.orders << ' ' << info.rawBytes << ' ' << info.storedBytes << ' ' << info.compressed << ' '
+                    << info.file << '\n';
+            }
+            if (!out.good())
+                return false;
+        }
+        error_code ec;
+        filesystem::rename(tmpPath, path, ec);
+        return !ec;
+    }
+
+    void add(const SegmentInfo &info)
+    {
+        vector<SegmentInfo>::iterator at = lower_bound(segments.begin(), segments.end(), info,
+                                                       [](const SegmentInfo &a, const SegmentInfo &b)
+                                                       { return a.sequence < b.sequence || (a.sequence == b.sequence && a.shard < b.shard); });
+        if (at != segments.end() && at->sequence == info.sequence && at->shard == info.shard)
+            *at = info;
+        else
+            segments.insert(at, info);
+    }
+
+    SegmentInfo *find(unsigned long long sequence, size_t shard)
+    {
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            if (segments[i].sequence == sequence && segments[i].shard == shard)
+                return &segments[i];
+        }
+        return nullptr;
+    }
+
+    // Segments whose ID range covers orderId, newest first
+    vector<SegmentInfo> candidates(int orderId) const
+    {
+        vector<SegmentInfo> found;
+        for (size_t i = segments.size(); i-- > 0;)
+        {
+            if (segments[i].firstOrderId <= orderId && orderId <= segments[i].lastOrderId)
+                found.push_back(segments[i]);
+        }
+        return found;
+    }
+
+    // Drops the oldest compressed segments beyond maxSegments and returns their files
+    vector<string> retain(size_t maxSegments)
+    {
+        vector<string> expired;
+        size_t i = 0;
+        while (segments.size() > maxSegments && i < segments.size())
+        {
+            if (segments[i].compressed)
+            {
+                expired.push_back(segments[i].file);
+                segments.erase(segments.begin() + i);
+            }
+            else
+            {
+                i++;
+            }
+        }
+        return expired;
+    }
+
+    vector<SegmentInfo> uncompressed() const
+    {
+        vector<SegmentInfo> found;
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            if (!segments[i].compressed)
+                found.push_back(segments[i]);
+        }
+        return found;
+    }
+
+    size_t size() const { return segments.size(); }
+    unsigned long long maxSequence() const { return segments.empty() ? 0 : segments.back().sequence; }
+
+    // Highest order ID logged so far, 0 if there is none
+    int maxOrderId() const
+    {
+        int highest = 0;
+        for (size_t i = 0; i < segments.size(); i++)
+        {
+            if (segments[i].orders > 0)
+                highest = max(highest, segments[i].lastOrderId);
+        }
+        return highest;
+    }
+};
+
+struct SegmentedLogConfig
+{
+    string directory;
+    size_t shards;                      // one segment file and writer thread per shard
+    unsigned long long maxSegmentBytes; // rotate once a segment reaches this size
+    int maxSegmentSeconds;              // or has been open this long (0 disables)
+    size_t maxSegments;                 // closed segments kept before the oldest are deleted
+    OrderLogConfig flush;
+
+    SegmentedLogConfig()
+        : directory("order_logs"), shards(1), maxSegmentBytes(4 * 1024 * 1024), maxSegmentSeconds(300), maxSegments(256) {}
+};
+
+const char SEGMENT_INDEX_FILE[] = "segments.idx";
+
+// Compressed segments use the project's own block framing (see SEGMENT_MAGIC),
+// not the LZ4 frame format, hence .olz rather than .lz4
+string segmentFileName(unsigned long long sequence, size_t shard, bool compressed)
+{
+    return "segment-" + to_string(sequence) + "-" + to_string(shard) + (compressed ? ".olz" : ".log");
+}
+
+// Extent of the "Order ID: <id>" record in a segment's text
+bool findOrderRecord(const string &text, int orderId, size_t &start, size_t &length)
+{
+    string header = "Order ID: " + to_string(orderId) + "\n";
+    for (size_t at = text.find(header); at != string::npos; at = text.find(header, at + 1))
+    {
+        if (at == 0 || text[at - 1] == '\n')
+        {
+            static const string separator = "---------------------------------\n\n";
+            size_t end = text.find(separator, at);
+            start = at;
+            length = (end == string::npos ? text.size() : end + separator.size()) - at;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Looks an order up through the segment index, reading only the segments that may hold it
+bool findLoggedOrder(const string &directory, int orderId, string &record)
+{
+    SegmentIndex index;
+    index.load(directory + "/" + SEGMENT_INDEX_FILE);
+    vector<SegmentInfo> candidates = index.candidates(orderId);
+    string text;
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        size_t start, length;
+        if (readSegmentText(directory + "/" + candidates[i].file, candidates[i].compressed, text) &&
+            findOrderRecord(text, orderId, start, length))
+        {
+            record.assign(text, start, length);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Order log split into per-shard segment files that rotate by size and age.
+// Closed segments are indexed by order ID range and compressed in the background;
+// only the newest maxSegments are kept.
+class SegmentedOrderLog
+{
+private:
+    // Sink for one logger shard; only its writer thread touches it
+    class Shard : public OrderLogSink
+    {
+    private:
+        SegmentedOrderLog &owner;
+        size_t number;
+        unique_ptr<OrderLogWriter> writer; // open segment, created on the first order
+        SegmentInfo current;
+        chrono::steady_clock::time_point openedAt;
+
+    public:
+        Shard(SegmentedOrderLog &log, size_t n) : owner(log), number(n) {}
+
+        void append(const Order &order) override
+        {
+            if (!writer)
+            {
+                current.sequence = owner.nextSequence.fetch_add(1);
+                current.shard = number;
+                current.firstOrderId = current.lastOrderId = order.getOrderId();
+                current.orders = 0;
+                current.compressed = false;
+                current.file = segmentFileName(current.sequence, number, false);
+                writer.reset(new OrderLogWriter(owner.config.directory + "/" + current.file, owner.config.flush));
+                openedAt = chrono::steady_clock::now();
+            }
+            writer->append(order);
+            current.firstOrderId = min(current.firstOrderId, order.getOrderId());
+            current.lastOrderId = max(current.lastOrderId, order.getOrderId());
+            current.orders++;
+            if (writer->bytesWritten() >= owner.config.maxSegmentBytes)
+            {
+                rotate();
+            }
+        }
+
+        void flushIfDue() override
+        {
+            if (!writer)
+                return;
+            writer->flushIfDue();
+            if (owner.config.maxSegmentSeconds > 0 &&
+                chrono::steady_clock::now() - openedAt >= chrono::seconds(owner.config.maxSegmentSeconds))
+            {
+                rotate();
+            }
+        }
+
+        void flush() override
+        {
+            if (writer)
+                writer->flush();
+        }
+
+        // Closes the open segment and hands it to the index and the compressor
+        void rotate()
+        {
+            if (!writer)
+                return;
+            current.rawBytes = current.storedBytes = writer->bytesWritten();
+            writer.reset();
+            owner.segmentClosed(current);
+        }
+    };
+
+    SegmentedLogConfig config;
+    vector<unique_ptr<Shard>> shards;
+    atomic<unsigned long long> nextSequence;
+
+    mutex indexLock;
+    SegmentIndex index;
+
+    // Closed segments waiting for compression
+    mutex queueLock;
+    condition_variable queueReady;
+    deque<SegmentInfo> pending;
+    bool closing;
+    thread compressor;
+
+    string pathOf(const string &file) const { return config.directory + "/" + file; }
+
+    void saveIndex()
+    {
+        if (!index.save(pathOf(SEGMENT_INDEX_FILE)))
+        {
+            cerr << "Warning: Could not write order log index in " << config.directory << "\n";
+        }
+    }
+
+    void segmentClosed(const SegmentInfo &info)
+    {
+        {
+            lock_guard<mutex> guard(indexLock);
+            index.add(info);
+            saveIndex();
+        }
+        {
+            lock_guard<mutex> guard(queueLock);
+            pending.push_back(info);
+        }
+        queueReady.notify_one();
+    }
+
+    void compress(const SegmentInfo &info)
+    {
+        string compressedFile = segmentFileName(info.sequence, info.shard, true);
+        unsigned long long stored = compressSegmentFile(pathOf(info.file), pathOf(compressedFile));
+        if (stored == 0)
+        {
+            cerr << "Warning: Could not compress order log segment " << info.file << "\n";
+            return;
+        }
+        vector<string> expired;
+        {
+            lock_guard<mutex> guard(indexLock);
+            SegmentInfo *entry = index.find(info.sequence, info.shard);
+            if (entry)
+            {
+                entry->compressed = true;
+                entry->storedBytes = stored;
+                entry->file = compressedFile;
+            }
+            expired = index.retain(config.maxSegments);
+            saveIndex();
+        }
+        // Removed only once the index no longer points at them
+        error_code ec;
+        filesystem::remove(pathOf(info.file), ec);
+        for (size_t i = 0; i < expired.size(); i++)
+        {
+            filesystem::remove(pathOf(expired[i]), ec);
+        }
+    }
+
+    void runCompressor()
+    {
+        unique_lock<mutex> lock(queueLock);
+        while (true)
+        {
+            queueReady.wait(lock, [this]
+                            { return closing || !pending.empty(); });
+            if (pending.empty())
+                return;
+            SegmentInfo info = pending.front();
+            pending.pop_front();
+            lock.unlock();
+            compress(info);
+            lock.lock();
+        }
+    }
+
+    // Picks up where the last run stopped: uncompressed segments are queued again,
+    // segment files missing from the index (a crash before rotation) are added and
+    // half-written compressed copies are deleted
+    void recover()
+    {
+        index.load(pathOf(SEGMENT_INDEX_FILE));
+        unsigned long long maxSequence = index.maxSequence();
+        error_code ec;
+        error_code removeError; // kept apart from ec, which drives the iteration
+        for (filesystem::directory_iterator it(config.directory, ec), end; !ec && it != end; it.increment(ec))
+        {
+            string name = it->path().filename().string();
+            if (name.compare(0, 8, "segment-") == 0 && name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0)
+            {
+                filesystem::remove(it->path(), removeError); // the raw segment is still there
+                continue;
+            }
+            unsigned long long sequence;
+            size_t shard;
+            char extension[4] = {};
+            if (sscanf(name.c_str(), "segment-%llu-%zu.%3s", &sequence, &shard, extension) != 3 ||
+                string(extension) != "log")
+                continue;
+            maxSequence = max(maxSequence, sequence);
+            SegmentInfo *entry = index.find(sequence, shard);
+            if (entry && entry->compressed)
+            {
+                filesystem::remove(it->path(), removeError); // compressed copy already indexed
+                continue;
+            }
+            if (entry)
+                continue;
+            string text;
+            if (!readWholeFile(pathOf(name), text))
+                continue;
+            SegmentInfo info = {sequence, shard, 0, -1, 0, text.size(), text.size(), false, name};
+            for (size_t at = text.find("Order ID: "); at != string::npos; at = text.find("Order ID: ", at + 1))
+            {
+                if (at != 0 && text[at - 1] != '\n')
+                    continue;
+                char *digitsEnd;
+                int id = (int)strtol(text.c_str() + at + 10, &digitsEnd, 10);
+                if (digitsEnd == text.c_str() + at + 10)
+                    continue;
+                info.firstOrderId = info.orders == 0 ? id : min(info.firstOrderId, id);
+                info.lastOrderId = info.orders == 0 ? id : max(info.lastOrderId, id);
+                info.orders++;
+            }
+            if (info.orders == 0)
+                filesystem::remove(it->path(), removeError);
+            else
+                index.add(info);
+        }
+        nextSequence.store(maxSequence + 1);
+        saveIndex();
+        vector<SegmentInfo> uncompressed = index.uncompressed();
+        pending.assign(uncompressed.begin(), uncompressed.end());
+    }
+
+public:
+    explicit SegmentedOrderLog(const SegmentedLogConfig &cfg) : config(cfg), nextSequence(1), closing(false)
+    {
+        error_code ec;
+        filesystem::create_directories(config.directory, ec);
+        if (ec)
+        {
+            cerr << "Warning: Could not create order log directory " << config.directory << "\n";
+        }
+        recover();
+        for (size_t i = 0; i < max(config.shards, (size_t)1); i++)
+        {
+            shards.push_back(unique_ptr<Shard>(new Shard(*this, i)));
+        }
+        compressor = thread(&SegmentedOrderLog::runCompressor, this);
+    }
+
+    SegmentedOrderLog(const SegmentedOrderLog &) = delete;
+    SegmentedOrderLog &operator=(const SegmentedOrderLog &) = delete;
+
+    // The logger using the sinks must already be shut down
+    ~SegmentedOrderLog() { close(); }
+
+    // One sink per shard, for AsyncOrderLogger
+    vector<OrderLogSink *> sinks()
+    {
+        vector<OrderLogSink *> result;
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            result.push_back(shards[i].get());
+        }
+        return result;
+    }
+
+    // Highest order ID in the retained segments; new IDs must start above it so
+    // that ID ranges never overlap across runs
+    int lastOrderId()
+    {
+        lock_guard<mutex> guard(indexLock);
+        return index.maxOrderId();
+    }
+
+    // Closes the open segments and waits for them to be compressed
+    void close()
+    {
+        for (size_t i = 0; i < shards.size(); i++)
+        {
+            shards[i]->rotate();
+        }
+        {
+            lock_guard<mutex> guard(queueLock);
+            closing = true;
+        }
+        queueReady.notify_one();
+        if (compressor.joinable())
+        {
+            compressor.join();
+        }
+    }
+};
+
+const size_t ORDER_PAGE_SIZE = 20;
+
+// Streams the order history one page (one write) at a time. With
+// promptBetweenPages the user is asked before each further page.
+void viewOrders(bool promptBetweenPages = false, size_t pageSize = ORDER_PAGE_SIZE)
+{
+    if (orderStore.size() == 0)
+    {
+        throw NoOrdersException();
+    }
+    TableRenderer &out = TableRenderer::shared();
+    out.text("\n===== Order History =====\n");
+    for (size_t first = 0; first < orderStore.size(); first += pageSize)
+    {
+        size_t last = min(orderStore.size(), first + pageSize);
+        for (size_t i = first; i < last; i++)
+        {
+            out.text("---------------------------------\n\n");
+            orderStore[i].render(out);
+        }
+        if (last == orderStore.size())
+        {
+            out.text("---------------------------------\n");
+        }
+        out.flushTo(cout);
+
+        if (promptBetweenPages && last < orderStore.size())
+        {
+            cout << "Show more orders? (Y/N): ";
+            char more = 'N';
+            cin >> more;
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            if (toupper(more) != 'Y')
+                break;
+        }
+    }
+}
+
+const size_t PRODUCT_PAGE_SIZE = 20;
+
+void renderProductHeader(TableRenderer &out)
+{
+    out.left("ID", ID_WIDTH + 2).left("Name", NAME_WIDTH).column("Price", PRICE_WIDTH).text("\n");
+}
+
+void renderProductRow(TableRenderer &out, const Product &p)
+{
+    out.right(p.getId(), ID_WIDTH).text("  ").left(p.getName(), NAME_WIDTH).column(p.getPrice(), PRICE_WIDTH).text("\n");
+}
+
+void renderProductTable(TableRenderer &out, const ProductCatalog &catalog)
+{
+    out.text("\nAvailable Products:\n");
+    out.text("---------------------------------\n");
+    renderProductHeader(out);
+    out.text("---------------------------------\n");
+    for (size_t i = 0; i < catalog.size(); i++)
+    {
+        renderProductRow(out, catalog[i]);
+    }
+    out.text("---------------------------------\n");
+}
+
+// Hot-path latency table followed by thrown exception counts
+void renderMetricsReport(TableRenderer &out)
+{
+    out.text("\n===== Metrics =====\n");
+    out.text("Path                Events     Sampled     Mean ns      p50 ns      p99 ns    p99.9 ns      Max ns\n");
+    for (int m = 0; m < Metrics::METRICS; m++)
+    {
+        Metrics::Summary summary = Metrics::summarize((Metric)m);
+        out.left(metricName((Metric)m), 14).right((long long)summary.events, 12).right((long long)summary.samples, 12);
+        out.right((long long)summary.meanNs, 12).right((long long)summary.p50Ns, 12).right((long long)summary.p99Ns, 12);
+        out.right((long long)summary.p999Ns, 12).right((long long)summary.maxNs, 12).text("\n");
+    }
+    out.text("Exceptions thrown:\n");
+    bool any = false;
+    for (int c = 1; c < Metrics::ERROR_CODES; c++)
+    {
+        unsigned long long count = Metrics::errorCount((ErrorCode)c);
+        if (count > 0)
+        {
+            out.text("  ").left(errorCodeName((ErrorCode)c), 22).right((long long)count, 10).text("\n");
+            any = true;
+        }
+    }
+    if (!any)
+        out.text("  none\n");
+}
+
+// Renders one page of name search results in the product table format
+void renderSearchPage(TableRenderer &out, const SearchPage &page, size_t offset)
+{
+    if (page.totalMatches == 0)
+    {
+        out.text("No matching products.\n");
+        return;
+    }
+    out.text("\nMatching Products ").number(offset + 1).text("-").number(offset + page.products.size());
+    out.text(" of ").number(page.totalMatches).text(":\n");
+    out.text("---------------------------------\n");
+    renderProductHeader(out);
+    out.text("---------------------------------\n");
+    for (size_t i = 0; i < page.products.size(); i++)
+    {
+        renderProductRow(out, *page.products[i]);
+    }
+    out.text("---------------------------------\n");
+}
+
+// Stores and logs the order for a paid cart, then empties the cart
+const Order &recordOrder(ShoppingCart &cart, string_view method, Money total, atomic<int> &nextOrderId,
+                         AsyncOrderLogger &orderLog)
+{
+    const Order &order = orderStore.add(nextOrderId.fetch_add(1, memory_order_relaxed), method, cart.getItems(), total);
+    orderLog.submit(order);
+    cart.completeCheckout();
+    return order;
+}
+
+// Checks out a cart: charges it, stores and logs the order, then empties the cart.
+// With a pricing snapshot every line is first re-priced against that one version.
+Expected<const Order *> checkoutCart(ShoppingCart &cart, int paymentId, PaymentRegistry &payments,
+                                     atomic<int> &nextOrderId, AsyncOrderLogger &orderLog,
+                                     const ProductCatalog *pricing = nullptr)
+{
+    if (pricing && !cart.isEmpty())
+    {
+        ErrorCode repriced = cart.repriceFrom(*pricing);
+        if (repriced != ErrorCode::None)
+            return repriced;
+    }
+    Expected<Money> total = cart.tryGetTotalAmount();
+    if (!total)
+        return total.getError();
+    ErrorCode paid = payments.tryPay(paymentId, *total);
+    if (paid != ErrorCode::None)
+        return paid;
+    return &recordOrder(cart, payments.methodName(paymentId), *total, nextOrderId, orderLog);
+}
+
+// Concurrent checkout service, run as a pipeline. A pool of workers takes
+// checkout requests for any session, totals the cart under its own lock and
+// hands the lines (with their stock reservations) to the payment lane for
+// the method, then moves on. Each lane batches authorizations across
+// workers and, as results come back, appends approved orders to the
+// OrderStore and queues them for the async log writer. A declined
+// payment goes back to the workers, which put the lines back into the
+// shopper's cart, so lanes never wait on a session lock.
+class CheckoutService
+{
+public:
+    typedef Expected<const Order *> Result;
+
+private:
+    struct Request
+    {
+        unsigned long long session;
+        int paymentId;
+        chrono::steady_clock::time_point submitted;
+        promise<Result> result;
+        Money total;
+        vector<CartItem> lines;
+        Inventory *inventory;
+        bool declined; // payment refused; lines still to be returned to the cart
+    };
+
+    CartManager &carts;
+    PaymentRegistry &payments;
+    atomic<int> &nextOrderId;
+    AsyncOrderLogger &orderLog;
+    VersionedCatalog *pricing; // optional; carts are re-priced from one snapshot
+
+    PaymentDispatcher dispatcher;
+    vector<unique_ptr<StrategyGateway>> gateways;
+    vector<int> laneFor; // payment method ID -> dispatcher lane, -1 if none
+
+    mutex lock;
+    condition_variable ready;
+    deque<shared_ptr<Request>> pending;
+    bool stopping;
+    vector<thread> workers;
+
+    static void finish(Request &request, const Result &result)
+    {
+        // End-to-end latency: queueing, payment batching and recording
+        chrono::steady_clock::duration elapsed = chrono::steady_clock::now() - request.submitted;
+        Metrics::recordEvent(Metric::Checkout,
+                             (unsigned long long)chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+        request.result.set_value(result);
+    }
+
+    // First stage, on a worker: prices the cart and takes its lines
+    ErrorCode admit(Request &request, VersionedCatalog::Reader *prices)
+    {
+        if (request.paymentId < 0 || (size_t)request.paymentId >= laneFor.size() || laneFor[request.paymentId] < 0)
+            return ErrorCode::InvalidPaymentMethod;
+
+        CartManager::CartHandle cart = carts.acquire(request.session);
+        if (prices && !cart->isEmpty())
+        {
+            ErrorCode repriced = cart->repriceFrom(prices->get());
+            if (repriced != ErrorCode::None)
+                return repriced;
+        }
+        Expected<Money> total = cart->tryGetTotalAmount();
+        if (!total)
+            return total.getError();
+        request.total = *total;
+        request.inventory = cart->getInventory();
+        cart->handOff(request.lines);
+        return ErrorCode::None;
+    }
+
+    // Last stage of a declined checkout, back on a worker
+    void returnLines(Request &request)
+    {
+        carts.acquire(request.session)->restore(request.lines);
+        finish(request, ErrorCode::Other);
+    }
+
+    // Second stage, on the payment lane: records the order, or queues the
+    // lines to be returned
+    void settle(const shared_ptr<Request> &request, const PaymentResult &paid)
+    {
+        if (!paid.approved)
+        {
+            request->declined = true;
+            {
+                lock_guard<mutex> guard(lock);
+                pending.push_front(request);
+            }
+            ready.notify_one();
+            return;
+        }
+        const Order &order = orderStore.add(nextOrderId.fetch_add(1, memory_order_relaxed),
+                                            payments.methodName(request->paymentId), request->lines, request->total);
+        orderLog.submit(order);
+        if (request->inventory)
+        {
+            for (size_t i = 0; i < request->lines.size(); i++)
+            {
+                request->inventory->commit(request->lines[i].getProduct().getId(), request->lines[i].getQuantity());
+            }
+        }
+        finish(*request, &order);
+    }
+
+    void run()
+    {
+        // Workers are long-lived, so each keeps its own snapshot of the prices
+        unique_ptr<VersionedCatalog::Reader> prices;
+        if (pricing)
+            prices.reset(new VersionedCatalog::Reader(*pricing));
+        while (true)
+        {
+            shared_ptr<Request> request;
+            {
+                unique_lock<mutex> guard(lock);
+                ready.wait(guard, [this]
+                           { return stopping || !pending.empty(); });
+                if (pending.empty())
+                    return; // stopping with nothing left to check out
+                request = std::move(pending.front());
+                pending.pop_front();
+            }
+            try
+            {
+                if (request->declined)
+                {
+                    returnLines(*request);
+                    continue;
+                }
+                ErrorCode admitted = admit(*request, prices.get());
+                if (admitted != ErrorCode::None)
+                {
+                    finish(*request, admitted);
+                    continue;
+                }
+                dispatcher.submit(laneFor[request->paymentId], request->total, [this, request](const PaymentResult &paid)
+                                  {
+                    try
+                    {
+                        settle(request, paid);
+                    }
+                    catch (...)
+                    {
+                        request->result.set_exception(current_exception());
+                    } });
+            }
+            catch (...)
+            {
+                request->result.set_exception(current_exception());
+            }
+        }
+    }
+
+public:
+    // Payment methods must all be registered before the service is created
+    CheckoutService(CartManager &c, PaymentRegistry &p, atomic<int> &ids, AsyncOrderLogger &log,
+                    size_t workerCount = thread::hardware_concurrency(), VersionedCatalog *catalog = nullptr)
+        : carts(c), payments(p), nextOrderId(ids), orderLog(log), pricing(catalog), stopping(false)
+    {
+        laneFor.assign(payments.maxId() + 1, -1);
+        for (int id = 0; id <= payments.maxId(); id++)
+        {
+            if (payments.contains(id))
+            {
+                gateways.push_back(unique_ptr<StrategyGateway>(new StrategyGateway(payments.resolve(id))));
+                laneFor[id] = dispatcher.addGateway(*gateways.back());
+            }
+        }
+        if (workerCount == 0)
+            workerCount = 1;
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            workers.push_back(thread(&CheckoutService::run, this));
+        }
+    }
+
+    CheckoutService(const CheckoutService &) = delete;
+    CheckoutService &operator=(const CheckoutService &) = delete;
+
+    ~CheckoutService() { shutdown(); }
+
+    // Queues a checkout of the session's cart; safe to call from any thread
+    future<Result> submit(unsigned long long session, int paymentId)
+    {
+        shared_ptr<Request> request = make_shared<Request>();
+        request->session = session;
+        request->paymentId = paymentId;
+        request->submitted = chrono::steady_clock::now();
+        request->inventory = nullptr;
+        request->declined = false;
+        future<Result> result = request->result.get_future();
+        {
+            lock_guard<mutex> guard(lock);
+            pending.push_back(std::move(request));
+        }
+        ready.notify_one();
+        return result;
+    }
+
+    // Completes every queued checkout, then stops the workers and payment lanes
+    // (which settle the payments still in flight). Payments declined after the
+    // workers stopped are returned to their carts here.
+    void shutdown()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            if (workers[i].joinable())
+            {
+                workers[i].join();
+            }
+        }
+        dispatcher.shutdown();
+        while (!pending.empty())
+        {
+            shared_ptr<Request> request = std::move(pending.front());
+            pending.pop_front();
+            returnLines(*request);
+        }
+    }
+};
+
+// Prints one page of query results in the order history format
+void displayOrderPage(const OrderPage &page, const OrderQuery &query)
+{
+    if (page.totalMatches == 0)
+    {
+        cout << "No matching orders.\n";
+        return;
+    }
+    TableRenderer &out = TableRenderer::shared();
+    out.text("\n===== Orders ").number(query.offset + 1).text("-").number(query.offset + page.orders.size());
+    out.text(" of ").number(page.totalMatches).text(" =====\n");
+    for (size_t i = 0; i < page.orders.size(); i++)
+    {
+        out.text("---------------------------------\n\n");
+        page.orders[i]->render(out);
+    }
+    out.text("---------------------------------\n");
+    out.flushTo(cout);
+}
+
+// Splits off the next whitespace-separated token
+string_view nextToken(string_view &text)
+{
+    size_t start = text.find_first_not_of(" \t\r");
+    if (start == string_view::npos)
+    {
+        text = string_view();
+        return string_view();
+    }
+    size_t end = text.find_first_of(" \t\r", start);
+    if (end == string_view::npos)
+        end = text.size();
+    string_view token = text.substr(start, end - start);
+    text.remove_prefix(end);
+    return token;
+}
+
+template <typename T>
+Expected<T> parseNumber(string_view token)
+{
+    T value;
+    from_chars_result result = from_chars(token.data(), token.data() + token.size(), value);
+    if (token.empty() || result.ec != errc() || result.ptr != token.data() + token.size())
+        return ErrorCode::InvalidInput;
+    return value;
+}
+
+// Parses "key=value" filters for the batch query command
+Expected<OrderQuery> parseOrderQuery(string_view args, const PaymentRegistry &payments)
+{
+    OrderQuery query;
+    size_t page = 1;
+    for (string_view token = nextToken(args); !token.empty(); token = nextToken(args))
+    {
+        size_t eq = token.find('=');
+        if (eq == string_view::npos)
+            return ErrorCode::InvalidInput;
+        string_view key = token.substr(0, eq);
+        Expected<long long> value = parseNumber<long long>(token.substr(eq + 1));
+        if (!value || *value < 0)
+            return ErrorCode::InvalidInput;
+
+        if (key == "method")
+        {
+            if (!payments.contains((int)*value))
+                return ErrorCode::InvalidPaymentMethod;
+            query.paymentMethod = string(payments.methodName((int)*value));
+        }
+        else if (key == "from" || key == "to")
+        {
+            if (!query.hasDateRange)
+            {
+                query.hasDateRange = true;
+                query.from = 0;
+                query.to = numeric_limits<time_t>::max();
+            }
+            (key == "from" ? query.from : query.to) = (time_t)*value;
+        }
+        else if (key == "page" && *value > 0)
+            page = (size_t)*value;
+        else if (key == "size" && *value > 0)
+            query.limit = (size_t)*value;
+        else
+            return ErrorCode::InvalidInput;
+    }
+    query.offset = (page - 1) * query.limit;
+    return query;
+}
+
+struct BatchStats
+{
+    size_t commands;
+    size_t errors;
+    size_t orders;
+};
+
+// Replays a recorded session without rendering menus. One command per line:
+//   add <product id> [quantity]   checkout <payment id>   session <id>
+//   view   orders   clear         find <order id>
+//   query [method=<payment id>] [from=<epoch>] [to=<epoch>] [page=<n>] [size=<n>]
+//   price <product id> <cents>    (publishes a new catalog version)
+//   search <name text> [page=<n>] [size=<n>]
+//   metrics                       (prints the hot-path metrics so far)
+//   (lines starting with # are ignored)
+BatchStats runBatch(string_view script, VersionedCatalog &catalog, ProductSearchIndex &productSearch,
+                    CartManager &carts, PaymentRegistry &payments, atomic<int> &nextOrderId,
+                    AsyncOrderLogger &orderLog)
+{
+    BatchStats stats = {0, 0, 0};
+    VersionedCatalog::Reader reader(catalog);
+    unsigned long long session = 1;
+    size_t lineNumber = 0;
+    while (!script.empty())
+    {
+        size_t newline = script.find('\n');
+        string_view line = script.substr(0, newline);
+        script.remove_prefix(newline == string_view::npos ? script.size() : newline + 1);
+        lineNumber++;
+
+        string_view command = nextToken(line);
+        if (command.empty() || command[0] == '#')
+            continue;
+        stats.commands++;
+
+        ErrorCode error = ErrorCode::None;
+        if (command == "add")
+        {
+            Expected<int> id = parseNumber<int>(nextToken(line));
+            string_view qtyToken = nextToken(line);
+            Expected<int> quantity = qtyToken.empty() ? Expected<int>(1) : parseNumber<int>(qtyToken);
+            Expected<const Product *> product = id ? reader.get().tryFind(*id) : Expected<const Product *>(id.getError());
+            if (!product)
+                error = product.getError();
+            else if (!quantity || *quantity < 1)
+                error = ErrorCode::InvalidInput;
+            else
+                error = carts.acquire(session)->tryAddProduct(**product, *quantity);
+        }
+        else if (command == "checkout")
+        {
+            Expected<int> paymentId = parseNumber<int>(nextToken(line));
+            if (!paymentId)
+            {
+                error = paymentId.getError();
+            }
+            else
+            {
+                CartManager::CartHandle cart = carts.acquire(session);
+                Expected<const Order *> order = checkoutCart(*cart, *paymentId, payments, nextOrderId, orderLog,
+                                                             reader.pin().get());
+                if (order)
+                    stats.orders++;
+                else
+                    error = order.getError();
+            }
+        }
+        else if (command == "search")
+        {
+            string text;
+            size_t page = 1, size = PRODUCT_PAGE_SIZE;
+            for (string_view token = nextToken(line); !token.empty(); token = nextToken(line))
+            {
+                bool isPage = token.substr(0, 5) == "page=";
+                if (isPage || token.substr(0, 5) == "size=")
+                {
+                    Expected<size_t> value = parseNumber<size_t>(token.substr(5));
+                    if (!value || *value == 0)
+                        error = ErrorCode::InvalidInput;
+                    else
+                        (isPage ? page : size) = *value;
+                    continue;
+                }
+                if (!text.empty())
+                    text += ' ';
+                text.append(token.data(), token.size());
+            }
+            if (error == ErrorCode::None)
+            {
+                size_t offset = (page - 1) * size;
+                renderSearchPage(TableRenderer::shared(), productSearch.search(reader.get(), text, offset, size), offset);
+                TableRenderer::shared().flushTo(cout);
+            }
+        }
+        else if (command == "metrics")
+        {
+            renderMetricsReport(TableRenderer::shared());
+            TableRenderer::shared().flushTo(cout);
+        }
+        else if (command == "price")
+        {
+            Expected<int> id = parseNumber<int>(nextToken(line));
+            Expected<long long> cents = parseNumber<long long>(nextToken(line));
+            if (!id || !cents || *cents < 0)
+                error = ErrorCode::InvalidInput;
+            else if (!catalog.setPrice(*id, Money::fromCents(*cents)))
+                error = ErrorCode::InvalidId;
+        }
+        else if (command == "session")
+        {
+            Expected<unsigned long long> id = parseNumber<unsigned long long>(nextToken(line));
+            if (id)
+                session = *id;
+            else
+                error = id.getError();
+        }
+        else if (command == "view")
+        {
+            carts.acquire(session)->displayCart();
+        }
+        else if (command == "orders")
+        {
+            if (orderStore.size() == 0)
+                error = ErrorCode::NoOrders;
+            else
+                viewOrders();
+        }
+        else if (command == "clear")
         {
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            throw InvalidInputException();
+            carts.acquire(session)->clearCart();
         }
-
-        if (cin.peek() != '\n')
+        else if (command == "find")
         {
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            throw InvalidInputException();
+            Expected<int> orderId = parseNumber<int>(nextToken(line));
+            const Order *order = orderId ? orderStore.findById(*orderId) : nullptr;
+            if (!orderId)
+                error = orderId.getError();
+            else if (!order)
+                error = ErrorCode::NoOrders;
+            else
+                order->display();
+        }
+        else if (command == "query")
+        {
+            Expected<OrderQuery> query = parseOrderQuery(line, payments);
+            if (!query)
+                error = query.getError();
+            else
+                displayOrderPage(orderStore.query(*query), *query);
+        }
+        else
+        {
+            error = ErrorCode::UnknownCommand;
         }
 
-        cin.ignore();
-        return value;
+        if (error != ErrorCode::None)
+        {
+            stats.errors++;
+            cerr << "Error (line " << lineNumber << "): " << errorMessage(error) << "\n";
+        }
     }
+    return stats;
 }
 
-// Product class
-class Product
+// Micro-benchmarks for the cart, order and logging hot paths (--bench)
+struct BenchConfig
 {
-private:
-    int id;
-    string name;
-    double price;
-
-public:
-    Product(int id, const string &name, double price) : id(id), name(name), price(price) {}
-
-    int getId() const { return id; }
-    string getName() const { return name; }
-    double getPrice() const { return price; }
+    vector<size_t> cartSizes;
+    vector<size_t> catalogSizes;
+    bool json;
 };
 
-// Shopping Cart Item class
-class CartItem
+struct BenchResult
 {
-private:
-    Product product;
-    int quantity;
-
-public:
-    CartItem(const Product &product, int quantity) : product(product), quantity(quantity) {}
-
-    Product getProduct() const { return product; }
-    int getQuantity() const { return quantity; }
-    void setQuantity(int qty) { quantity = qty; }
-    double getTotalPrice() const { return product.getPrice() * quantity; }
+    string name;
+    size_t cartSize;
+    size_t catalogSize;
+    unsigned long long operations; // per timed sample
+    double nsPerOp;                // best of the samples
 };
 
-// Payment Strategy Interface
-class PaymentStrategy
+// Swallows output so prompts do not skew the input benchmarks
+class NullBuffer : public streambuf
 {
-public:
-    virtual ~PaymentStrategy() {}
-    virtual void pay(double amount) = 0;
-    virtual string getMethodName() const = 0;
+protected:
+    int overflow(int c) override { return c; }
+    streamsize xsputn(const char *, streamsize n) override { return n; }
 };
 
-// Concrete Payment Strategies
-class CashPayment : public PaymentStrategy
-{
-public:
-    void pay(double amount) override {}
-    string getMethodName() const override { return "Cash"; }
-};
+const string BENCH_LOG_FILE = "bench_order_log.txt";
+volatile long long benchSink; // keeps benchmarked results observable
 
-class CardPayment : public PaymentStrategy
+// Times body(), which performs opsPerRun operations. The repeat count is
+// doubled until a sample takes at least 10 ms; the best of five samples is
+// reported. reset() runs untimed before every sample.
+template <typename Body, typename Reset>
+BenchResult measure(const char *name, size_t cartSize, size_t catalogSize, size_t opsPerRun, Body body, Reset reset)
 {
-public:
-    void pay(double amount) override {}
-    string getMethodName() const override { return "Credit/Debit Card"; }
-};
+    typedef chrono::steady_clock Clock;
+    unsigned long long runs = 1;
+    double best = 0;
+    for (int sample = -1; sample < 5; sample++)
+    {
+        while (true)
+        {
+            reset();
+            Clock::time_point start = Clock::now();
+            for (unsigned long long r = 0; r < runs; r++)
+            {
+                body();
+            }
+            double ns = chrono::duration<double, nano>(Clock::now() - start).count();
+            if (sample < 0 && ns < 1e7 && runs < (1ull << 30))
+            {
+                runs *= 2; // still calibrating
+                continue;
+            }
+            double perOp = ns / (double)(runs * (opsPerRun ? opsPerRun : 1));
+            if (sample >= 0 && (sample == 0 || perOp < best))
+                best = perOp;
+            break;
+        }
+    }
+    return BenchResult{name, cartSize, catalogSize, runs * (opsPerRun ? opsPerRun : 1), best};
+}
 
-class GCashPayment : public PaymentStrategy
+template <typename Body>
+BenchResult measure(const char *name, size_t cartSize, size_t catalogSize, size_t opsPerRun, Body body)
 {
-public:
-    void pay(double amount) override {}
-    string getMethodName() const override { return "GCash"; }
-};
+    return measure(name, cartSize, catalogSize, opsPerRun, body, [] {});
+}
 
-// Shopping Cart class (Singleton)
-class ShoppingCart
+// Parses a comma-separated list of positive sizes, e.g. "1,10,100"
+Expected<vector<size_t>> parseSizeList(string_view text)
 {
-private:
-    static ShoppingCart *instance;
-    CartItem **items;
-    int capacity;
-    int count;
-
-    ShoppingCart() : capacity(10), count(0)
+    vector<size_t> sizes;
+    while (!text.empty())
     {
-        items = new CartItem *[capacity];
+        size_t comma = text.find(',');
+        Expected<size_t> size = parseNumber<size_t>(text.substr(0, comma));
+        if (!size || *size == 0)
+            return ErrorCode::InvalidInput;
+        sizes.push_back(*size);
+        text.remove_prefix(comma == string_view::npos ? text.size() : comma + 1);
     }
+    if (sizes.empty())
+        return ErrorCode::InvalidInput;
+    return sizes;
+}
 
-public:
-    static ShoppingCart *getInstance()
+vector<BenchResult> runBenchmarks(const BenchConfig &config)
+{
+    vector<BenchResult> results;
+    for (size_t c = 0; c < config.catalogSizes.size(); c++)
     {
-        if (!instance)
+        size_t catalogSize = config.catalogSizes[c];
+        vector<Product> products;
+        products.reserve(catalogSize);
+        for (size_t i = 0; i < catalogSize; i++)
         {
-            instance = new ShoppingCart();
+            products.push_back(Product((int)i + 1, "Product " + to_string(i + 1), Money::fromCents(100 + (long long)(i % 9900))));
         }
-        return instance;
-    }
+        ProductCatalog catalog;
+        catalog.load(products);
 
-    ~ShoppingCart()
-    {
-        for (int i = 0; i < count; i++)
+        for (size_t s = 0; s < config.cartSizes.size(); s++)
         {
-            delete items[i];
+            size_t cartSize = config.cartSizes[s];
+            size_t lines = cartSize < catalogSize ? cartSize : catalogSize;
+            size_t distinct = lines / 4 > 0 ? lines / 4 : 1; // three in four adds hit an existing line
+            ShoppingCart cart;
+
+            // Each add looks the product up by ID first, as the menu does
+            results.push_back(measure("cart.add.unique", cartSize, catalogSize, lines, [&]
+                                      {
+                cart.clearCart();
+                for (size_t i = 0; i < lines; i++)
+                {
+                    cart.addProduct(*catalog.find((int)i + 1));
+                } }));
+            results.push_back(measure("cart.add.duplicate", cartSize, catalogSize, cartSize, [&]
+                                      {
+                cart.clearCart();
+                for (size_t i = 0; i < cartSize; i++)
+                {
+                    cart.addProduct(*catalog.find((int)(i % distinct) + 1));
+                } }));
+
+            cart.clearCart();
+            for (size_t i = 0; i < lines; i++)
+            {
+                cart.addProduct(*catalog.find((int)i + 1));
+            }
+            // getTotalAmount() only reads the running total, so time the kernel that
+            // re-sums the pricing columns, and the checkout path that reprices first
+            results.push_back(measure("cart.total", cartSize, catalogSize, 1, [&]
+                                      { benchSink = benchSink + cart.recomputeTotal().getCents(); }));
+            results.push_back(measure("cart.total.repriced", cartSize, catalogSize, 1, [&]
+                                      {
+                cart.repriceFrom(catalog);
+                benchSink = benchSink + cart.tryGetTotalAmount()->getCents(); }));
+
+            unique_ptr<OrderStore> store;
+            int orderId = 0;
+            results.push_back(measure(
+                "order.create", cartSize, catalogSize, 1, [&]
+                { store->add(++orderId, "Cash", cart.getItems(), cart.getTotalAmount(), 0); },
+                [&]
+                { store.reset(new OrderStore()); }));
+
+            const Order &order = store->add(1, "Cash", cart.getItems(), cart.getTotalAmount(), 0);
+            ofstream logFile;
+            results.push_back(measure(
+                "order.logToFile", cartSize, catalogSize, 1, [&]
+                { order.logToFile(logFile); },
+                [&]
+                {
+                    logFile.close();
+                    logFile.open(BENCH_LOG_FILE, ios::out | ios::trunc);
+                }));
+            logFile.close();
+            results.push_back(measure(
+                "order.logOrderToFile", cartSize, catalogSize, 1, [&]
+                { logOrderToFile(order, BENCH_LOG_FILE); },
+                [&]
+                { ofstream(BENCH_LOG_FILE, ios::out | ios::trunc); }));
         }
-        delete[] items;
     }
+    error_code ec;
+    filesystem::remove(BENCH_LOG_FILE, ec);
 
-    void addProduct(const Product &product, int quantity = 1)
+    // Input parsing does not depend on cart or catalog size
+    const size_t INPUT_LINES = 1000;
+    const string prompt = "";
+    string valid, invalid;
+    for (size_t i = 0; i < INPUT_LINES; i++)
     {
-        for (int i = 0; i < count; i++)
+        valid += to_string(i * 37 % 1000) + "\n";
+        invalid += "abc\n";
+    }
+    NullBuffer discard;
+    streambuf *savedIn = cin.rdbuf();
+    streambuf *savedOut = cout.rdbuf(&discard);
+    results.push_back(measure("input.getValidatedInput", 0, 0, INPUT_LINES, [&]
+                              {
+        istringstream in(valid);
+        cin.rdbuf(in.rdbuf());
+        for (size_t i = 0; i < INPUT_LINES; i++)
         {
-            if (items[i]->getProduct().getId() == product.getId())
-            {
-                items[i]->setQuantity(items[i]->getQuantity() + quantity);
-                return;
-            }
+            benchSink = benchSink + getValidatedInput<int>(prompt);
         }
-
-        if (count == capacity)
+        cin.rdbuf(savedIn); }));
+    results.push_back(measure("input.getValidatedInput.invalid", 0, 0, INPUT_LINES, [&]
+                              {
+        istringstream in(invalid);
+        cin.rdbuf(in.rdbuf());
+        for (size_t i = 0; i < INPUT_LINES; i++)
         {
-            capacity *= 2;
-            CartItem **newItems = new CartItem *[capacity];
-            for (int i = 0; i < count; i++)
+            try
+            {
+                benchSink = benchSink + getValidatedInput<int>(prompt);
+            }
+            catch (const InvalidInputException &)
             {
-                newItems[i] = items[i];
             }
-            delete[] items;
-            items = newItems;
         }
-
-        items[count++] = new CartItem(product, quantity);
-    }
-
-    void displayCart() const
-    {
-        if (count == 0)
+        cin.rdbuf(savedIn); }));
+    results.push_back(measure("input.tryGetValidatedInput.invalid", 0, 0, INPUT_LINES, [&]
+                              {
+        istringstream in(invalid);
+        cin.rdbuf(in.rdbuf());
+        for (size_t i = 0; i < INPUT_LINES; i++)
         {
-            cout << "Your shopping cart is empty.\n";
-            return;
+            benchSink = benchSink + (int)tryGetValidatedInput<int>("").getError();
         }
+        cin.rdbuf(savedIn); }));
+    cout.rdbuf(savedOut);
+    cin.clear();
+    return results;
+}
 
-        cout << "\nShopping Cart:\n";
-        cout << "---------------------------------------------------------\n";
-        cout << "ID   Name            Price   Qty  Total\n";
-        cout << "---------------------------------------------------------\n";
-
-        double total = 0;
-        for (int i = 0; i < count; i++)
+void writeBenchResults(ostream &out, const vector<BenchResult> &results, bool json)
+{
+    if (!json)
+    {
+        out << "benchmark,cart_size,catalog_size,operations,ns_per_op,ops_per_sec\n";
+        for (size_t i = 0; i < results.size(); i++)
         {
-            const Product &p = items[i]->getProduct();
-            double itemTotal = items[i]->getTotalPrice();
-            total += itemTotal;
-
-            cout.width(4);
-            cout << p.getId();
-            cout << "  ";
-            cout.width(14);
-            cout << left << p.getName();
-            cout.width(7);
-            cout << right << (int)p.getPrice();
-            cout.width(5);
-            cout << right << items[i]->getQuantity();
-            cout.width(7);
-            cout << right << (int)itemTotal << "\n";
+            const BenchResult &r = results[i];
+            out << r.name << "," << r.cartSize << "," << r.catalogSize << "," << r.operations << ","
+                << r.nsPerOp << "," << (r.nsPerOp > 0 ? 1e9 / r.nsPerOp : 0.0) << "\n";
         }
+        return;
+    }
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        out << "  {\"benchmark\": \"" << r.name << "\", \"cart_size\": " << r.cartSize
+            << ", \"catalog_size\": " << r.catalogSize << ", \"operations\": " << r.operations
+            << ", \"ns_per_op\": " << r.nsPerOp << ", \"ops_per_sec\": " << (r.nsPerOp > 0 ? 1e9 / r.nsPerOp : 0.0)
+            << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+// Synthetic load (--loadgen): simulated shoppers fill carts and check out
+// through the CheckoutService as fast as it completes them. The load is closed
+// loop, one checkout in flight per shopper, and the reported latency runs from
+// submit to completion of each checkout. It does not include the delay a
+// shopper on a fixed arrival schedule would have seen while the service was
+// backed up, so p99 is service latency at the offered load, not response time
+// against an open arrival rate.
+struct LoadConfig
+{
+    size_t shoppers;      // simulated sessions, spread over the driver threads
+    size_t threads;       // driver threads
+    double seconds;       // how long to generate load
+    double zipfExponent;  // product popularity skew; 0 is uniform
+    double meanCartSize;  // cart sizes are geometric with this mean (at least 1)
+    vector<int> payIds;   // payment method mix ...
+    vector<double> payWeights; // ... and relative weights
+};
 
-        cout << "---------------------------------------------------------\n";
-        cout << "Total: " << (int)total << "\n";
-        cout << "---------------------------------------------------------\n";
+// Parses "<payment id>:<weight>,..." e.g. "1:60,2:30,3:10"; at least one
+// weight must be positive
+bool parsePaymentMix(string_view text, LoadConfig &config)
+{
+    config.payIds.clear();
+    config.payWeights.clear();
+    double totalWeight = 0;
+    while (!text.empty())
+    {
+        size_t comma = text.find(',');
+        string_view entry = text.substr(0, comma);
+        text.remove_prefix(comma == string_view::npos ? text.size() : comma + 1);
+        size_t colon = entry.find(':');
+        Expected<int> id = parseNumber<int>(entry.substr(0, colon));
+        Expected<double> weight = colon == string_view::npos ? Expected<double>(1.0) : parseNumber<double>(entry.substr(colon + 1));
+        if (!id || !weight || !(*weight >= 0) || isinf(*weight))
+            return false;
+        config.payIds.push_back(*id);
+        config.payWeights.push_back(*weight);
+        totalWeight += *weight;
     }
+    return !config.payIds.empty() && totalWeight > 0;
+}
 
-    double getTotalAmount() const
+// Draws catalog positions with probability proportional to 1 / rank^exponent
+class ZipfSampler
+{
+private:
+    vector<double> cumulative;
+
+public:
+    ZipfSampler(size_t count, double exponent) : cumulative(count)
     {
-        if (count == 0)
-            throw EmptyCartException();
         double total = 0;
-        for (int i = 0; i < count; i++)
+        for (size_t k = 0; k < count; k++)
         {
-            total += items[i]->getTotalPrice();
+            total += 1.0 / pow((double)(k + 1), exponent);
+            cumulative[k] = total;
         }
-        return total;
     }
 
-    void clearCart()
+    template <typename Rng>
+    size_t operator()(Rng &rng) const
     {
-        for (int i = 0; i < count; i++)
-        {
-            delete items[i];
-        }
-        count = 0;
+        uniform_real_distribution<double> uniform(0.0, cumulative.back());
+        size_t k = lower_bound(cumulative.begin(), cumulative.end(), uniform(rng)) - cumulative.begin();
+        return k < cumulative.size() ? k : cumulative.size() - 1;
     }
+};
 
-    bool isEmpty() const
+// Returns 0 if every checkout succeeded, 2 otherwise
+int runLoadGenerator(const LoadConfig &config, VersionedCatalog &catalog, CartManager &carts, CheckoutService &checkout)
+{
+    size_t productCount = catalog.snapshot()->size();
+    if (productCount == 0)
     {
-        return count == 0;
+        cerr << "Error: The catalog is empty\n";
+        return 1;
     }
+    ZipfSampler popularity(productCount, config.zipfExponent);
+    atomic<bool> stop(false);
+    atomic<unsigned long long> orders(0), items(0), failures(0), outOfStock(0);
 
-    CartItem **getItems() const { return items; }
-    int getItemCount() const { return count; }
-};
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(config.seconds));
 
-ShoppingCart *ShoppingCart::instance = nullptr;
+    vector<thread> drivers;
+    for (size_t t = 0; t < config.threads; t++)
+    {
+        drivers.push_back(thread([&, t]
+                                 {
+            mt19937_64 rng(0x5eed + t);
+            // 1 + geometric extra lines has mean meanCartSize; at a mean of 1 or less
+            // every cart gets exactly one line (the distribution needs p < 1)
+            bool singleLine = config.meanCartSize <= 1;
+            geometric_distribution<int> extraItems(singleLine ? 0.5 : 1.0 / config.meanCartSize);
+            discrete_distribution<size_t> paymentPick(config.payWeights.begin(), config.payWeights.end());
+            VersionedCatalog::Reader reader(catalog);
 
-// Order class
-class Order
-{
-private:
-    int orderId;
-    string paymentMethod;
-    CartItem **items;
-    int itemCount;
-    double totalAmount;
-    string timestamp;
+            // This driver's shoppers. Each runs its own closed loop: its next cart
+            // is filled and submitted as soon as its previous checkout completes,
+            // so a slow checkout holds up only that shopper, not the whole driver.
+            vector<unsigned long long> sessions;
+            for (size_t s = t; s < config.shoppers; s += config.threads)
+            {
+                sessions.push_back(s + 1);
+            }
+            vector<future<CheckoutService::Result>> pending(sessions.size());
+            auto shop = [&](size_t s)
+            {
+                const ProductCatalog &products = reader.get();
+                int lines = singleLine ? 1 : 1 + extraItems(rng);
+                {
+                    CartManager::CartHandle cart = carts.acquire(sessions[s]);
+                    for (int i = 0; i < lines; i++)
+                    {
+                        if (cart->tryAddProduct(products[popularity(rng)]) == ErrorCode::OutOfStock)
+                            outOfStock.fetch_add(1, memory_order_relaxed);
+                    }
+                }
+                pending[s] = checkout.submit(sessions[s], config.payIds[paymentPick(rng)]);
+            };
+            for (size_t s = 0; s < sessions.size(); s++)
+            {
+                shop(s);
+            }
 
-public:
-    Order(int id, string method, CartItem **cartItems, int count, double total)
-        : orderId(id), paymentMethod(method), itemCount(count), totalAmount(total)
+            size_t inFlight = sessions.size();
+            for (size_t next = 0; inFlight > 0; next = (next + 1) % sessions.size())
+            {
+                if (!pending[next].valid())
+                    continue;
+                // Sleep briefly on a busy checkout; latency is recorded when the
+                // checkout completes, so this only delays the shopper's next cart
+                if (pending[next].wait_for(chrono::microseconds(200)) != future_status::ready)
+                    continue;
+                CheckoutService::Result result = pending[next].get();
+                inFlight--;
+                if (result)
+                {
+                    orders.fetch_add(1, memory_order_relaxed);
+                    items.fetch_add((*result)->getItemCount(), memory_order_relaxed);
+                }
+                else
+                {
+                    failures.fetch_add(1, memory_order_relaxed);
+                    carts.acquire(sessions[next])->clearCart();
+                }
+                if (Clock::now() >= deadline)
+                    stop.store(true, memory_order_relaxed);
+                if (!stop.load(memory_order_relaxed))
+                {
+                    shop(next);
+                    inFlight++;
+                }
+            } }));
+    }
+    for (size_t t = 0; t < drivers.size(); t++)
     {
-        // Get current time for timestamp
-        time_t now = time(0);
-        timestamp = ctime(&now);
-        timestamp = timestamp.substr(0, timestamp.length() - 1); // Remove newline
+        drivers[t].join();
+    }
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
 
-        items = new CartItem *[itemCount];
-        for (int i = 0; i < itemCount; i++)
+    Metrics::Summary latency = Metrics::summarize(Metric::Checkout);
+    cout << "Load generator: " << config.shoppers << " shoppers on " << config.threads << " threads, "
+         << productCount << " products, zipf " << config.zipfExponent << ", mean cart " << config.meanCartSize << "\n";
+    cout << "Orders: " << orders.load() << " in " << seconds << " s (" << orders.load() / seconds
+         << " orders/sec, " << items.load() / seconds << " lines/sec), failed checkouts: " << failures.load()
+         << ", out-of-stock adds: " << outOfStock.load() << "\n";
+    cout << "Checkout latency: p50 " << latency.p50Ns / 1000 << " us, p99 " << latency.p99Ns / 1000 << " us, p99.9 "
+         << latency.p999Ns / 1000 << " us, max " << latency.maxNs / 1000 << " us\n";
+    return failures.load() == 0 ? 0 : 2;
+}
+
+int main(int argc, char *argv[])
+{
+    // --journal also records every order in the binary journal;
+    // --recover rebuilds order history from that journal instead of clearing it
+    // --batch <file> replays a command file instead of running the menu
+    // --stock <units> tracks every product with that many units on hand
+    // --catalog <file> maps a catalog image instead of the built-in products;
+    // --export-catalog <file> writes the catalog as an image and exits
+    // --loadgen runs simulated shoppers instead of the menu; tuned with
+    // --shoppers <n> --threads <n> --duration <s> --zipf <s> --cart-mean <n>
+    // and --payment-mix <id:weight,...>
+    // --metrics prints the hot-path metrics on exit
+    // --bench [csv|json] runs the micro-benchmarks and exits; sizes are set with
+    // --bench-carts <n,n,...> and --bench-catalogs <n,n,...>
+    // --log-shards <n> writes the order log as rotating, compressed segments in
+    // order_logs/, sized by --log-segment-bytes <n>, --log-segment-seconds <s>
+    // and --log-keep-segments <n>; --log-find <id> prints a logged order and exits
+    bool useJournal = false;
+    SegmentedLogConfig segmentConfig;
+    bool segmentedLogging = false;
+    int findOrderId = 0;
+    bool showMetrics = false;
+    bool loadgen = false;
+    size_t hardwareThreads = thread::hardware_concurrency() ? thread::hardware_concurrency() : 4;
+    LoadConfig loadConfig = {1000, hardwareThreads, 5.0, 1.0, 4.0, {1, 2, 3}, {1.0, 1.0, 1.0}};
+    bool bench = false;
+    BenchConfig benchConfig = {{1, 10, 100, 1000}, {1000, 100000}, false};
+    bool recover = false;
+    string batchFile;
+    string catalogFile;
+    string exportFile;
+    int stockUnits = -1;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--batch" && i + 1 < argc)
+        {
+            batchFile = argv[++i];
+        }
+        else if (arg == "--loadgen")
+        {
+            loadgen = true;
+        }
+        else if ((arg == "--shoppers" || arg == "--threads") && i + 1 < argc)
+        {
+            Expected<size_t> count = parseNumber<size_t>(argv[++i]);
+            if (!count || *count == 0)
+                cerr << "Warning: Ignoring invalid count " << argv[i] << "\n";
+            else
+                (arg == "--shoppers" ? loadConfig.shoppers : loadConfig.threads) = *count;
+        }
+        else if ((arg == "--duration" || arg == "--zipf" || arg == "--cart-mean") && i + 1 < argc)
+        {
+            Expected<double> value = parseNumber<double>(argv[++i]);
+            if (!value || *value < 0)
+                cerr << "Warning: Ignoring invalid value " << argv[i] << "\n";
+            else
+                (arg == "--duration" ? loadConfig.seconds : arg == "--zipf" ? loadConfig.zipfExponent : loadConfig.meanCartSize) = *value;
+        }
+        else if (arg == "--payment-mix" && i + 1 < argc)
+        {
+            LoadConfig parsed = loadConfig;
+            if (parsePaymentMix(argv[++i], parsed))
+                loadConfig = parsed;
+            else
+                cerr << "Warning: Ignoring invalid payment mix " << argv[i] << "\n";
+        }
+        else if (arg == "--metrics")
+        {
+            showMetrics = true;
+        }
+        else if (arg == "--bench")
+        {
+            bench = true;
+            if (i + 1 < argc && (string(argv[i + 1]) == "json" || string(argv[i + 1]) == "csv"))
+                benchConfig.json = string(argv[++i]) == "json";
+        }
+        else if ((arg == "--bench-carts" || arg == "--bench-catalogs") && i + 1 < argc)
+        {
+            Expected<vector<size_t>> sizes = parseSizeList(argv[++i]);
+            if (!sizes)
+                cerr << "Warning: Ignoring invalid size list " << argv[i] << "\n";
+            else
+                (arg == "--bench-carts" ? benchConfig.cartSizes : benchConfig.catalogSizes) = *sizes;
+        }
+        else if ((arg == "--log-shards" || arg == "--log-keep-segments") && i + 1 < argc)
+        {
+            Expected<size_t> count = parseNumber<size_t>(argv[++i]);
+            if (!count || *count == 0)
+                cerr << "Warning: Ignoring invalid count " << argv[i] << "\n";
+            else
+                (arg == "--log-shards" ? segmentConfig.shards : segmentConfig.maxSegments) = *count;
+            segmentedLogging = true;
+        }
+        else if (arg == "--log-segment-bytes" && i + 1 < argc)
+        {
+            Expected<unsigned long long> bytes = parseNumber<unsigned long long>(argv[++i]);
+            if (!bytes || *bytes == 0)
+                cerr << "Warning: Ignoring invalid segment size " << argv[i] << "\n";
+            else
+                segmentConfig.maxSegmentBytes = *bytes;
+            segmentedLogging = true;
+        }
+        else if (arg == "--log-segment-seconds" && i + 1 < argc)
+        {
+            Expected<int> seconds = parseNumber<int>(argv[++i]);
+            if (!seconds || *seconds < 0)
+                cerr << "Warning: Ignoring invalid segment age " << argv[i] << "\n";
+            else
+                segmentConfig.maxSegmentSeconds = *seconds;
+            segmentedLogging = true;
+        }
+        else if (arg == "--log-find" && i + 1 < argc)
+        {
+            Expected<int> id = parseNumber<int>(argv[++i]);
+            if (id && *id > 0)
+                findOrderId = *id;
+            else
+                cerr << "Warning: Ignoring invalid order ID " << argv[i] << "\n";
+        }
+        else if (arg == "--catalog" && i + 1 < argc)
+        {
+            catalogFile = argv[++i];
+        }
+        else if (arg == "--export-catalog" && i + 1 < argc)
+        {
+            exportFile = argv[++i];
+        }
+        else if (arg == "--stock" && i + 1 < argc)
+        {
+            Expected<int> units = parseNumber<int>(argv[++i]);
+            if (units && *units >= 0)
+                stockUnits = *units;
+            else
+                cerr << "Warning: Ignoring invalid stock level " << argv[i] << "\n";
+        }
+        else if (arg == "--journal")
+        {
+            useJournal = true;
+        }
+        else if (arg == "--recover")
+        {
+            useJournal = true;
+            recover = true;
+        }
+        else
         {
-            items[i] = new CartItem(*cartItems[i]);
+            cerr << "Warning: Ignoring unknown option " << argv[i] << "\n";
         }
     }
 
-    ~Order()
+    if (bench)
     {
-        for (int i = 0; i < itemCount; i++)
+        writeBenchResults(cout, runBenchmarks(benchConfig), benchConfig.json);
+        return 0;
+    }
+
+    if (findOrderId > 0)
+    {
+        string record;
+        if (!findLoggedOrder(segmentConfig.directory, findOrderId, record))
         {
-            delete items[i];
+            cerr << "Error: Order " << findOrderId << " not found in " << segmentConfig.directory << "\n";
+            return 1;
         }
-        delete[] items;
+        cout << record;
+        return 0;
     }
 
-    void display() const
+    ProductCatalog catalog;
+    catalog.load({Product(1, "Laptop", Money::fromCents(99999)),
+                  Product(2, "Smartphone", Money::fromCents(59999)),
+                  Product(3, "Headphones", Money::fromCents(9999)),
+                  Product(4, "Mouse", Money::fromCents(1999)),
+                  Product(5, "Keyboard", Money::fromCents(4999))});
+    if (!catalogFile.empty())
     {
-        cout << "\nOrder ID: " << orderId << "\n";
-        cout << "Date: " << timestamp << "\n";
-        cout << "Payment Method: " << paymentMethod << "\n";
-        cout << "Products:\n";
-        cout << "ID   Name            Price   Qty\n";
-        for (int i = 0; i < itemCount; i++)
+        shared_ptr<MappedCatalog> image = make_shared<MappedCatalog>();
+        if (image->open(catalogFile))
+            catalog.loadImage(image);
+        else
+            cerr << "Warning: Could not map catalog image " << catalogFile << ", using built-in products\n";
+    }
+    if (!exportFile.empty())
+    {
+        if (!writeCatalogImage(exportFile, catalog))
         {
-            Product p = items[i]->getProduct();
-            cout.width(4);
-            cout << p.getId();
-            cout << "  ";
-            cout.width(14);
-            cout << left << p.getName();
-            cout.width(7);
-            cout << right << (int)p.getPrice();
-            cout.width(5);
-            cout << right << items[i]->getQuantity() << "\n";
+            cerr << "Error: Could not write catalog image " << exportFile << "\n";
+            return 1;
         }
-        cout << "Total Amount: " << (int)totalAmount << "\n";
+        cout << "Wrote " << catalog.size() << " products to " << exportFile << ".\n";
+        return 0;
     }
 
-    void logToFile(ofstream &file) const
+    // Rebuild recent order history and the order ID sequence before logging resumes
+    RecoveryResult recovered = {0, 1, false, false, 0, vector<unsigned long long>()};
+    if (recover)
     {
-        file << "Order ID: " << orderId << "\n";
-        file << "Date: " << timestamp << "\n";
-        file << "Payment Method: " << paymentMethod << "\n";
-        file << "Products:\n";
-        file << "ID   Name            Price   Qty\n";
-        for (int i = 0; i < itemCount; i++)
+        recovered = recoverOrders(orderStore, ORDER_JOURNAL_FILE, ORDER_CHECKPOINT_FILE);
+        cout << "Recovered " << recovered.ordersRecovered << " orders"
+             << (recovered.usedCheckpoint ? " from checkpoint" : "") << ".\n";
+        if (recovered.truncatedTail)
+        {
+            cerr << "Warning: Discarded a damaged record at the end of the order journal.\n";
+        }
+        if (recovered.skippedBytes > 0)
         {
-            Product p = items[i]->getProduct();
-            file.width(4);
-            file << p.getId();
-            file << "  ";
-            file.width(14);
-            file << left << p.getName();
-            file.width(7);
-            file << right << (int)p.getPrice();
-            file.width(5);
-            file << right << items[i]->getQuantity() << "\n";
+            cerr << "Warning: Skipped " << recovered.skippedBytes
+                 << " damaged bytes in the order journal; they were left in place.\n";
         }
-        file << "Total Amount: " << (int)totalAmount << "\n";
-        file << "---------------------------------\n\n";
     }
-};
-
-// Order storage
-Order *orders[100];
-int orderCount = 0;
-const string ORDER_LOG_FILE = "order_log.txt";
 
-void initializeOrderLog()
-{
-    // Clear the log file at startup
-    ofstream outFile(ORDER_LOG_FILE, ios::out | ios::trunc);
-    if (outFile.is_open())
+    // Initialize order log (clears previous content unless recovering); segmented
+    // logs keep their history and bound it by segment count instead
+    unique_ptr<SegmentedOrderLog> segmentedLog;
+    unique_ptr<OrderLogWriter> orderLog;
+    vector<OrderLogSink *> logSinks;
+    int firstOrderId = recovered.nextOrderId;
+    if (segmentedLogging)
     {
-        outFile << "===== ORDER LOG =====\n";
-        outFile << "Application started. Log cleared.\n\n";
-        outFile.close();
+        segmentedLog.reset(new SegmentedOrderLog(segmentConfig));
+        logSinks = segmentedLog->sinks();
+        firstOrderId = max(firstOrderId, segmentedLog->lastOrderId() + 1);
     }
     else
     {
-        cerr << "Warning: Could not open order log file for clearing.\n";
+        initializeOrderLog(recover, recovered.ordersRecovered);
+        orderLog.reset(new OrderLogWriter(ORDER_LOG_FILE));
+        logSinks.push_back(orderLog.get());
     }
-}
-
-void logOrderToFile(const Order &order)
-{
-    ofstream outFile(ORDER_LOG_FILE, ios::out | ios::app);
-    if (outFile.is_open())
+    unique_ptr<OrderJournalWriter> journal;
+    if (useJournal)
     {
-        order.logToFile(outFile);
-        outFile.close();
+        journal.reset(new OrderJournalWriter(ORDER_JOURNAL_FILE, !recover));
+        journal->enableCheckpoints(ORDER_CHECKPOINT_FILE, RECOVERY_RETAIN_ORDERS, CHECKPOINT_EVERY_ORDERS,
+                                   firstOrderId, recovered.recordOffsets);
     }
-    else
+    AsyncOrderLogger asyncLog(logSinks, journal.get());
+
+    PaymentRegistry payments;
+    registerBuiltinPayments(payments);
+
+    // Built now for in-memory catalogs; a mapped image is indexed on first search
+    ProductSearchIndex productSearch;
+    if (catalogFile.empty())
     {
-        cerr << "Warning: Could not open order log file for writing.\n";
+        productSearch.build(catalog);
     }
-}
 
-void viewOrders()
-{
-    if (orderCount == 0)
+    VersionedCatalog liveCatalog(catalog);
+    VersionedCatalog::Reader browser(liveCatalog);
+
+    Inventory inventory;
+    if (stockUnits >= 0)
     {
-        throw NoOrdersException();
+        for (size_t i = 0; i < catalog.size(); i++)
+        {
+            inventory.setStock(catalog.idAt(i), stockUnits);
+        }
     }
-    cout << "\n===== Order History =====\n";
-    for (int i = 0; i < orderCount; i++)
+
+    CartManager cartManager(&inventory);
+    const unsigned long long sessionId = 1;
+    atomic<int> nextOrderId(firstOrderId);
+
+    if (loadgen)
     {
-        cout << "---------------------------------\n";
-        orders[i]->display();
+        for (size_t i = 0; i < loadConfig.payIds.size(); i++)
+        {
+            if (!payments.contains(loadConfig.payIds[i]))
+            {
+                cerr << "Error: " << errorMessage(ErrorCode::InvalidPaymentMethod) << " " << loadConfig.payIds[i] << "\n";
+                return 1;
+            }
+        }
+        int status;
+        {
+            CheckoutService checkout(cartManager, payments, nextOrderId, asyncLog, hardwareThreads, &liveCatalog);
+            status = runLoadGenerator(loadConfig, liveCatalog, cartManager, checkout);
+        }
+        asyncLog.shutdown();
+        if (showMetrics)
+        {
+            renderMetricsReport(TableRenderer::shared());
+            TableRenderer::shared().flushTo(cout);
+        }
+        return status;
     }
-    cout << "---------------------------------\n";
-}
 
-int main()
-{
-    // Initialize order log (clears previous content)
-    initializeOrderLog();
+    if (!batchFile.empty())
+    {
+        ifstream in(batchFile, ios::in | ios::binary);
+        if (!in.is_open())
+        {
+            cerr << "Error: Could not open batch file " << batchFile << "\n";
+            return 1;
+        }
+        string script((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
 
-    const int productCount = 5;
-    Product *products[productCount] = {
-        new Product(1, "Laptop", 999.99),
-        new Product(2, "Smartphone", 599.99),
-        new Product(3, "Headphones", 99.99),
-        new Product(4, "Mouse", 19.99),
-        new Product(5, "Keyboard", 49.99)};
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        BatchStats stats = runBatch(script, liveCatalog, productSearch, cartManager, payments, nextOrderId, asyncLog);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    int nextOrderId = 1;
+        cout << "Batch complete: " << stats.commands << " commands, " << stats.orders << " orders, "
+             << stats.errors << " errors in " << seconds << " s ("
+             << (seconds > 0 ? stats.commands / seconds : 0.0) << " ops/sec)\n";
+        asyncLog.shutdown();
+        if (showMetrics)
+        {
+            renderMetricsReport(TableRenderer::shared());
+            TableRenderer::shared().flushTo(cout);
+        }
+        return stats.errors == 0 ? 0 : 2;
+    }
 
     while (true)
     {
@@ -420,71 +6048,58 @@ int main()
             cout << "3. View Orders\n";
             cout << "4. Exit\n";
 
-            int choice;
-            try
+            Expected<int> menuInput = tryGetValidatedInput<int>("Enter your choice (1-4): ");
+            if (menuInput.getError() == ErrorCode::EndOfInput)
             {
-                choice = getValidatedInput<int>("Enter your choice (1-4): ");
-                if (choice < 1 || choice > 4)
-                {
-                    throw ECommerceException("Invalid menu choice. Please select 1-4.");
-                }
+                break;
+            }
+            if (menuInput && (*menuInput < 1 || *menuInput > 4))
+            {
+                menuInput = ErrorCode::InvalidMenuChoice;
             }
-            catch (const ECommerceException &e)
+            if (!menuInput)
             {
-                cerr << "Error: " << e.what() << endl;
+                cerr << "Error: " << menuInput.message() << endl;
                 continue;
             }
+            int choice = *menuInput;
 
             if (choice == 1)
             {
                 char addMore;
                 do
                 {
-                    cout << "\nAvailable Products:\n";
-                    cout << "---------------------------------\n";
-                    cout << "ID   Name            Price\n";
-                    cout << "---------------------------------\n";
-
-                    for (int i = 0; i < productCount; i++)
+                    // Large catalogs are searched by name rather than listed in full
+                    shared_ptr<const ProductCatalog> shown = browser.pin();
+                    if (shown->size() > PRODUCT_PAGE_SIZE)
                     {
-                        cout.width(4);
-                        cout << products[i]->getId();
-                        cout << "  ";
-                        cout.width(14);
-                        cout << left << products[i]->getName();
-                        cout.width(7);
-                        cout << right << (int)products[i]->getPrice() << "\n";
+                        cout << "Search products by name: ";
+                        string text;
+                        getline(cin, text);
+                        renderSearchPage(TableRenderer::shared(), productSearch.search(*shown, text, 0, PRODUCT_PAGE_SIZE), 0);
                     }
-                    cout << "---------------------------------\n";
-
-                    int id;
-                    try
+                    else
                     {
-                        id = getValidatedInput<int>("Enter the ID of the product you want to add to the shopping cart: ");
+                        renderProductTable(TableRenderer::shared(), *shown);
                     }
-                    catch (const ECommerceException &e)
+                    TableRenderer::shared().flushTo(cout);
+
+                    Expected<int> id = tryGetValidatedInput<int>("Enter the ID of the product you want to add to the shopping cart: ");
+                    if (!id)
                     {
-                        cerr << "Error: " << e.what() << endl;
+                        cerr << "Error: " << id.message() << endl;
                         continue;
                     }
 
-                    Product *selectedProduct = nullptr;
-                    for (int i = 0; i < productCount; i++)
-                    {
-                        if (products[i]->getId() == id)
-                        {
-                            selectedProduct = products[i];
-                            break;
-                        }
-                    }
+                    Expected<const Product *> selectedProduct = shown->tryFind(*id);
 
                     if (!selectedProduct)
                     {
-                        cerr << "Error: Invalid product ID\n";
+                        cerr << "Error: " << selectedProduct.message() << "\n";
                         continue;
                     }
 
-                    ShoppingCart::getInstance()->addProduct(*selectedProduct);
+                    cartManager.acquire(sessionId)->addProduct(**selectedProduct);
                     cout << "Product added successfully!\n";
 
                     cout << "Do you want to add another product? (Y/N): ";
@@ -496,7 +6111,7 @@ int main()
             }
             else if (choice == 2)
             {
-                ShoppingCart *cart = ShoppingCart::getInstance();
+                CartManager::CartHandle cart = cartManager.acquire(sessionId);
                 cart->displayCart();
 
                 if (!cart->isEmpty())
@@ -510,46 +6125,32 @@ int main()
                     if (checkoutChoice == 'Y')
                     {
                         cout << "\nSelect payment method:\n";
-                        cout << "1. Cash\n";
-                        cout << "2. Credit/Debit Card\n";
-                        cout << "3. GCash\n";
+                        for (int id = 1; id <= payments.maxId(); id++)
+                        {
+                            if (payments.contains(id))
+                            {
+                                cout << id << ". " << payments.methodName(id) << "\n";
+                            }
+                        }
 
                         int paymentChoice;
-                        paymentChoice = getValidatedInput<int>("Enter your choice (1-3): ");
+                        paymentChoice = getValidatedInput<int>("Enter your choice (1-" + to_string(payments.maxId()) + "): ");
 
-                        PaymentStrategy *strategy = nullptr;
-                        switch (paymentChoice)
+                        Expected<const Order *> newOrder = checkoutCart(*cart, paymentChoice, payments, nextOrderId, asyncLog,
+                                                                        browser.pin().get());
+                        if (!newOrder)
                         {
-                        case 1:
-                            strategy = new CashPayment();
-                            break;
-                        case 2:
-                            strategy = new CardPayment();
-                            break;
-                        case 3:
-                            strategy = new GCashPayment();
-                            break;
+                            cerr << "Error: " << newOrder.message() << "\n";
+                            continue;
                         }
 
-                        double total = cart->getTotalAmount();
-                        strategy->pay(total);
-
-                        Order *newOrder = new Order(nextOrderId++, strategy->getMethodName(), cart->getItems(), cart->getItemCount(), total);
-                        orders[orderCount++] = newOrder;
-
-                        // Log the order to file
-                        logOrderToFile(*newOrder);
-
                         cout << "\nYou have successfully checked out the products!\n";
-
-                        cart->clearCart();
-                        delete strategy;
                     }
                 }
             }
             else if (choice == 3)
             {
-                viewOrders();
+                viewOrders(true);
             }
             else if (choice == 4)
             {
@@ -563,13 +6164,12 @@ int main()
         }
     }
 
-    for (int i = 0; i < productCount; i++)
-    {
-        delete products[i];
-    }
-    for (int i = 0; i < orderCount; i++)
+    // Write out any orders still queued for logging
+    asyncLog.shutdown();
+    if (showMetrics)
     {
-        delete orders[i];
+        renderMetricsReport(TableRenderer::shared());
+        TableRenderer::shared().flushTo(cout);
     }
 
     return 0;